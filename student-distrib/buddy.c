@@ -0,0 +1,234 @@
+#include "buddy.h"
+
+#define BUDDY_NONE              0xFFFF              /* the end of a free list */
+#define BUDDY_FREE              0x80                /* page_orders: the page starts a free block */
+#define BUDDY_USED              0x7F                /* page_orders: allocated, or inside a block */
+
+#define PAGE_UP(x)              (((x) + BUDDY_PAGE_SIZE - 1) & ~(BUDDY_PAGE_SIZE - 1))
+#define PAGE_DOWN(x)            ((x) & ~(BUDDY_PAGE_SIZE - 1))
+#define CHECK_FLAG(flags, bit)  ((flags) & (1 << (bit)))
+
+/* the metadata is kept apart from the pages, which are never touched */
+static uint8_t page_orders[BUDDY_PAGE_COUNT];       /* order | BUDDY_FREE, or BUDDY_USED */
+static uint16_t free_next[BUDDY_PAGE_COUNT];        /* next free block of the same order */
+static uint16_t free_prev[BUDDY_PAGE_COUNT];        /* previous free block of the same order */
+static uint16_t free_heads[BUDDY_MAX_ORDER + 1];    /* the block handed out next, per order */
+static uint32_t free_counts[BUDDY_MAX_ORDER + 1];   /* free blocks per order */
+static uint32_t managed_end = BUDDY_START;          /* end of the highest usable page */
+static uint32_t total_pages = 0;                    /* pages handed to the allocator at boot */
+
+/**
+ * @brief puts the block at page \p pfn on the free list of \p order
+ *
+ * @param pfn the first page of the block
+ * @param order the order of the block
+ */
+static void buddy_push(uint32_t pfn, uint32_t order) {
+    free_prev[pfn] = BUDDY_NONE;
+    free_next[pfn] = free_heads[order];
+    if (free_heads[order] != BUDDY_NONE) {
+        free_prev[free_heads[order]] = pfn;
+    }
+    free_heads[order] = pfn;
+    page_orders[pfn] = BUDDY_FREE | order;
+    ++free_counts[order];
+}
+
+/**
+ * @brief takes the block at page \p pfn off the free list of \p order
+ *
+ * @param pfn the first page of the block
+ * @param order the order of the block
+ */
+static void buddy_remove(uint32_t pfn, uint32_t order) {
+    if (free_prev[pfn] != BUDDY_NONE) {
+        free_next[free_prev[pfn]] = free_next[pfn];
+    } else {
+        free_heads[order] = free_next[pfn];
+    }
+    if (free_next[pfn] != BUDDY_NONE) {
+        free_prev[free_next[pfn]] = free_prev[pfn];
+    }
+    page_orders[pfn] = BUDDY_USED;
+    --free_counts[order];
+}
+
+/**
+ * @brief checks if the page at \p addr holds a multiboot module
+ *
+ * @param mbi the multiboot information
+ * @param addr the page
+ * @return 1 if so, 0 if not
+ */
+static int32_t buddy_in_module(multiboot_info_t *mbi, uint32_t addr) {
+    uint32_t i;
+    module_t *mod = (module_t *)mbi->mods_addr;
+    if (!CHECK_FLAG(mbi->flags, 3)) {
+        return 0;
+    }
+    for (i = 0; i < mbi->mods_count; ++i, ++mod) {
+        if (addr + BUDDY_PAGE_SIZE > mod->mod_start && addr < mod->mod_end) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief frees the pages of [\p start, \p end) that the allocator can
+ * manage
+ *
+ * @param mbi the multiboot information
+ * @param start the start of usable memory
+ * @param end the end of usable memory
+ */
+static void buddy_add(multiboot_info_t *mbi, uint32_t start, uint32_t end) {
+    uint32_t addr;
+    start = start < BUDDY_START ? BUDDY_START : PAGE_UP(start);
+    end = end > BUDDY_LIMIT ? BUDDY_LIMIT : PAGE_DOWN(end);
+    for (addr = start; addr < end; addr += BUDDY_PAGE_SIZE) {
+        if (!buddy_in_module(mbi, addr)) {
+            free_pages((void *)addr, 0);            /* merges into the largest blocks */
+            ++total_pages;
+        }
+    }
+    if (start < end && end > managed_end) {
+        managed_end = end;
+    }
+}
+
+/**
+ * @brief hands every usable page of the multiboot memory map between
+ * BUDDY_START and BUDDY_LIMIT to the allocator, except the modules;
+ * called before paging is enabled, as the map is in low memory
+ *
+ * @param mbi the multiboot information
+ */
+void buddy_init(multiboot_info_t *mbi) {
+    uint32_t i, end;
+    memory_map_t *mmap;
+
+    memset(page_orders, BUDDY_USED, sizeof(page_orders));
+    for (i = 0; i <= BUDDY_MAX_ORDER; ++i) {
+        free_heads[i] = BUDDY_NONE;
+        free_counts[i] = 0;
+    }
+    managed_end = BUDDY_START;
+    total_pages = 0;
+
+    if (CHECK_FLAG(mbi->flags, 6)) {
+        for (mmap = (memory_map_t *)mbi->mmap_addr;
+             (uint32_t)mmap < mbi->mmap_addr + mbi->mmap_length;
+             mmap = (memory_map_t *)((uint32_t)mmap + mmap->size + sizeof(mmap->size))) {
+            if (mmap->type != 1 || mmap->base_addr_high) {
+                continue;                           /* reserved, or above 4 GB */
+            }
+            end = mmap->base_addr_low + mmap->length_low;
+            if (mmap->length_high || end < mmap->base_addr_low) {
+                end = BUDDY_LIMIT;                  /* beyond 4 GB */
+            }
+            buddy_add(mbi, mmap->base_addr_low, end);
+        }
+    } else if (CHECK_FLAG(mbi->flags, 0)) {
+        buddy_add(mbi, 0x100000, 0x100000 + mbi->mem_upper * 1024);    /* upper memory starts at 1 MB */
+    }
+}
+
+/**
+ * @brief finds the end of the memory managed by the allocator, which
+ * the kernel maps to itself
+ *
+ * @return the end address, aligned to 4 MB
+ */
+uint32_t buddy_end() {
+    return (managed_end + 0x3FFFFF) & ~0x3FFFFF;
+}
+
+/**
+ * @brief allocates 2^\p order contiguous pages, aligned to their size
+ *
+ * @param order the order of the block
+ * @return the physical address of the block, which the kernel can use
+ * as it is identity mapped; NULL if there is no such block. The
+ * contents are not cleared
+ */
+void *get_free_pages(uint32_t order) {
+    uint32_t flags, pfn, k;
+    if (order > BUDDY_MAX_ORDER) {
+        return NULL;
+    }
+
+    cli_and_save(flags);
+    for (k = order; k <= BUDDY_MAX_ORDER && free_heads[k] == BUDDY_NONE; ++k);
+    if (k > BUDDY_MAX_ORDER) {
+        restore_flags(flags);
+        return NULL;                                /* out of memory */
+    }
+    pfn = free_heads[k];
+    buddy_remove(pfn, k);
+    while (k > order) {                             /* splits, the upper halves stay free */
+        --k;
+        buddy_push(pfn + (1 << k), k);
+    }
+    restore_flags(flags);
+    return (void *)(pfn * BUDDY_PAGE_SIZE);
+}
+
+/**
+ * @brief releases a block from \c get_free_pages, merging it with its
+ * free buddies
+ *
+ * @param addr the block, nullable
+ * @param order the order it was allocated with
+ */
+void free_pages(void *addr, uint32_t order) {
+    uint32_t flags, buddy, pfn = (uint32_t)addr / BUDDY_PAGE_SIZE;
+    if (!addr) {
+        return;
+    }
+
+    cli_and_save(flags);
+    for (; order < BUDDY_MAX_ORDER; ++order) {
+        buddy = pfn ^ (1 << order);
+        if (buddy >= BUDDY_PAGE_COUNT || page_orders[buddy] != (BUDDY_FREE | order)) {
+            break;                                  /* the buddy is in use, or not memory */
+        }
+        buddy_remove(buddy, order);
+        pfn &= ~(1 << order);
+    }
+    buddy_push(pfn, order);
+    restore_flags(flags);
+}
+
+/**
+ * @brief counts the free blocks of one order
+ *
+ * @param order the order
+ * @return number of free blocks of exactly that order
+ */
+uint32_t buddy_free_blocks(uint32_t order) {
+    return order > BUDDY_MAX_ORDER ? 0 : free_counts[order];
+}
+
+/**
+ * @brief counts the free pages of all orders
+ *
+ * @return number of free 4 KB pages
+ */
+uint32_t buddy_free_pages() {
+    uint32_t order, pages = 0;
+    for (order = 0; order <= BUDDY_MAX_ORDER; ++order) {
+        pages += free_counts[order] << order;
+    }
+    return pages;
+}
+
+/**
+ * @brief counts the pages found usable at boot, which other allocators
+ * size themselves by
+ *
+ * @return number of 4 KB pages managed
+ */
+uint32_t buddy_total_pages() {
+    return total_pages;
+}
@@ -0,0 +1,72 @@
+#ifndef _BUDDY_H
+#define _BUDDY_H
+
+#include "lib.h"
+#include "multiboot.h"
+
+#define BUDDY_PAGE_SIZE         0x1000
+#define BUDDY_MAX_ORDER         10                  /* the largest block is 4 MB */
+#define BUDDY_START             0x800000            /* the kernel and video memory are below */
+#define BUDDY_LIMIT             0x8000000           /* identity mapped up to the user entry at 128 MB */
+#define BUDDY_PAGE_COUNT        (BUDDY_LIMIT / BUDDY_PAGE_SIZE)
+
+/**
+ * @brief hands every usable page of the multiboot memory map between
+ * BUDDY_START and BUDDY_LIMIT to the allocator, except the modules;
+ * called before paging is enabled, as the map is in low memory
+ *
+ * @param mbi the multiboot information
+ */
+void buddy_init(multiboot_info_t *mbi);
+
+/**
+ * @brief finds the end of the memory managed by the allocator, which
+ * the kernel maps to itself
+ *
+ * @return the end address, aligned to 4 MB
+ */
+uint32_t buddy_end();
+
+/**
+ * @brief allocates 2^\p order contiguous pages, aligned to their size
+ *
+ * @param order the order of the block
+ * @return the physical address of the block, which the kernel can use
+ * as it is identity mapped; NULL if there is no such block. The
+ * contents are not cleared
+ */
+void *get_free_pages(uint32_t order);
+
+/**
+ * @brief releases a block from \c get_free_pages, merging it with its
+ * free buddies
+ *
+ * @param addr the block, nullable
+ * @param order the order it was allocated with
+ */
+void free_pages(void *addr, uint32_t order);
+
+/**
+ * @brief counts the free blocks of one order
+ *
+ * @param order the order
+ * @return number of free blocks of exactly that order
+ */
+uint32_t buddy_free_blocks(uint32_t order);
+
+/**
+ * @brief counts the free pages of all orders
+ *
+ * @return number of free 4 KB pages
+ */
+uint32_t buddy_free_pages();
+
+/**
+ * @brief counts the pages found usable at boot, which other allocators
+ * size themselves by
+ *
+ * @return number of 4 KB pages managed
+ */
+uint32_t buddy_total_pages();
+
+#endif
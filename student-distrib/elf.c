@@ -0,0 +1,150 @@
+#include "elf.h"
+#include "lib.h"
+#include "filesys.h"
+#include "syscall.h"
+
+#define ELF_CLASS_32            1                   /* e_ident[EI_CLASS] */
+#define ELF_DATA_LSB            1                   /* e_ident[EI_DATA] */
+#define ELF_TYPE_EXEC           2
+#define ELF_MACHINE_386         3
+#define ELF_PT_LOAD             1
+#define ELF_PF_X                0x1
+#define ELF_PF_W                0x2
+#define ELF_SHT_NULL            0
+#define ELF_PHNUM_MAX           16
+
+#define PAGE_SIZE               0x1000
+#define PAGE_DOWN(x)            ((x) & ~(PAGE_SIZE - 1))
+
+typedef struct elf_header_t {
+    uint32_t magic;
+    uint8_t class;
+    uint8_t data;
+    uint8_t ident_version;
+    uint8_t ident_pad[9];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint32_t entry;
+    uint32_t phoff;
+    uint32_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} __attribute__((packed)) elf_header_t;
+
+typedef struct elf_phdr_t {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t vaddr;
+    uint32_t paddr;
+    uint32_t filesz;
+    uint32_t memsz;
+    uint32_t flags;
+    uint32_t align;
+} elf_phdr_t;
+
+/**
+ * @brief checks if the file was laid out flat by elfconvert, which
+ * moves every segment to its address minus the first page, leaves
+ * p_offset as it was and blanks the section headers
+ *
+ * @param inode the inode of the file
+ * @param header the ELF header of the file
+ * @return 1 if flat, 0 if p_offset can be trusted
+ */
+static int32_t elf_is_flat(uint32_t inode, elf_header_t *header) {
+    uint32_t type;
+    if (header->shnum < 2 || header->shentsize < 2 * sizeof(uint32_t)) {
+        return 0;
+    }
+    if (read_data(inode, header->shoff + header->shentsize + sizeof(uint32_t),
+                  (uint8_t *)&type, sizeof(uint32_t)) != sizeof(uint32_t)) {
+        return 0;
+    }
+    return type == ELF_SHT_NULL;                    /* only the first section may be null */
+}
+
+/**
+ * @brief reads and checks the ELF headers of the file at \p inode
+ *
+ * @param inode the inode of the file
+ * @param elf the layout returned
+ * @return 0 if the file is a loadable 32-bit x86 executable, -1 if not
+ */
+int32_t elf_parse(uint32_t inode, elf_t *elf) {
+    elf_header_t header;
+    elf_phdr_t phdrs[ELF_PHNUM_MAX], *ph;
+    elf_segment_t *seg;
+    uint32_t i, j, size, base = -1, flat, runnable = 0;
+
+    if (inode >= boot_block->inode_count) {
+        return -1;
+    }
+    size = inode_blocks[inode].file_size;
+    if (read_data(inode, 0, (uint8_t *)&header, sizeof(header)) != sizeof(header)
+        || header.magic != EXECUTABLE_MAGIC
+        || header.class != ELF_CLASS_32
+        || header.data != ELF_DATA_LSB
+        || header.type != ELF_TYPE_EXEC
+        || header.machine != ELF_MACHINE_386
+        || header.phentsize != sizeof(elf_phdr_t)
+        || !header.phnum || header.phnum > ELF_PHNUM_MAX
+        || read_data(inode, header.phoff, (uint8_t *)phdrs, header.phnum * sizeof(elf_phdr_t))
+           != header.phnum * sizeof(elf_phdr_t)) {
+        return -1;                                  /* not an executable for this machine */
+    }
+
+    elf->entry = header.entry;
+    elf->count = 0;
+    for (i = 0, ph = phdrs; i < header.phnum; ++i, ++ph) {
+        if (ph->type != ELF_PT_LOAD || !ph->memsz) {
+            continue;
+        }
+        if (elf->count == ELF_SEGMENT_MAX
+            || ph->filesz > ph->memsz
+            || ph->vaddr < (USER_ENTRY << 22)
+            || ph->vaddr >= USER_HEAP_LIMIT
+            || ph->memsz > USER_HEAP_LIMIT - ph->vaddr) {
+            return -1;                              /* too many, or out of user memory */
+        }
+
+        for (j = elf->count; j && elf->segments[j - 1].start > ph->vaddr; --j) {
+            elf->segments[j] = elf->segments[j - 1];    /* keeps them sorted */
+        }
+        seg = elf->segments + j;
+        seg->start = ph->vaddr;
+        seg->file_end = ph->vaddr + ph->filesz;
+        seg->end = ph->vaddr + ph->memsz;
+        seg->offset = ph->offset;
+        seg->writable = ph->flags & ELF_PF_W;
+        if (PAGE_DOWN(ph->vaddr) < base) {
+            base = PAGE_DOWN(ph->vaddr);
+        }
+        if ((ph->flags & ELF_PF_X) && header.entry >= seg->start && header.entry < seg->file_end) {
+            runnable = 1;                           /* the entry is in executable code */
+        }
+        ++elf->count;
+    }
+    if (!runnable) {
+        return -1;                                  /* nothing to run */
+    }
+
+    flat = elf_is_flat(inode, &header);
+    for (i = 0, seg = elf->segments; i < elf->count; ++i, ++seg) {
+        if (flat) {
+            seg->offset = seg->start - base;
+        }
+        if (i && seg->start < seg[-1].end) {
+            return -1;                              /* overlapping segments */
+        }
+        if (seg->offset > size || seg->file_end - seg->start > size - seg->offset) {
+            return -1;                              /* truncated file */
+        }
+    }
+    return 0;
+}
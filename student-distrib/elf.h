@@ -0,0 +1,37 @@
+#ifndef _ELF_H
+#define _ELF_H
+
+#include "types.h"
+
+#define ELF_SEGMENT_MAX         4                   /* loadable segments a program may have */
+
+/**
+ * @brief \c elf_segment_t is a PT_LOAD segment as it is mapped in user memory
+ */
+typedef struct elf_segment_t {
+    uint32_t start;             /* first byte in user memory */
+    uint32_t file_end;          /* end of the bytes read from the file, bss follows */
+    uint32_t end;               /* end of the segment in user memory */
+    uint32_t offset;            /* position of \c start in the file */
+    uint32_t writable;          /* mapped read-only if not set */
+} elf_segment_t;
+
+/**
+ * @brief \c elf_t is the layout of a checked executable
+ */
+typedef struct elf_t {
+    uint32_t entry;             /* the first instruction to run */
+    uint32_t count;             /* number of segments */
+    elf_segment_t segments[ELF_SEGMENT_MAX];    /* sorted by address, not overlapping */
+} elf_t;
+
+/**
+ * @brief reads and checks the ELF headers of the file at \p inode
+ *
+ * @param inode the inode of the file
+ * @param elf the layout returned
+ * @return 0 if the file is a loadable 32-bit x86 executable, -1 if not
+ */
+int32_t elf_parse(uint32_t inode, elf_t *elf);
+
+#endif
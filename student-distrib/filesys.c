@@ -1,4 +1,5 @@
 #include "filesys.h"
+#include "image.h"
 
 #define ATA_DATA                0x1F0
 #define ATA_SECTOR_COUNT        0x1F2
@@ -8,8 +9,7 @@
 #define ATA_DRIVE_SELECT        0x1F6
 #define ATA_STATUS              0x1F7
 
-#define ATA_MASTER_DRIVE        0xA0
-#define ATA_SLAVE_DRIVE         0xB0
+#define ATA_LBA                 0x40        /* drive select: addresses by LBA */
 
 #define ATA_FLAG_STATUS_ERROR   (1 << 0)
 #define ATA_FLAG_STATUS_INDEX   (1 << 1)
@@ -24,19 +24,22 @@
 
 #define ATA_SECTOR_SIZE         512         /* ATA contains 512 * 0x0FFFFFFF bytes */
 #define ATA_SECTOR_BOUND        0x0FFFFFFF
+#define ATA_POLL_LIMIT          100000      /* status reads before giving a drive up */
+#define ATA_IDENTIFY_LBA_SECTORS    60      /* words of IDENTIFY with the LBA28 sector count */
 
 #define ATA_BOOT_BLOCK_SIZE     (16 * ATA_SECTOR_COUNT)
 
 /**
- * @brief reads \p count of sectors starting at \p index to \p buf
- * the buffer size should be count * 512 (ATA_SECTOR_SIZE)
+ * @brief reads \p count of sectors starting at \p index of \p drive
+ * to \p buf, the buffer size should be count * 512 (ATA_SECTOR_SIZE)
  * 
+ * @param drive ATA_MASTER_DRIVE or ATA_SLAVE_DRIVE
  * @param index the starting index of the sector to read
  * @param count the count of sectors to read
  * @param buf the destination buffer
  * @return count of bytes read
  */
-uint32_t read_ata_sectors(uint32_t index, uint32_t count, uint8_t *buf) {
+uint32_t read_ata_drive(uint32_t drive, uint32_t index, uint32_t count, uint8_t *buf) {
     if (!buf || !count || index >= ATA_SECTOR_BOUND) {               /* checks illegal arguments */
         return 0;
     }
@@ -46,9 +49,10 @@ uint32_t read_ata_sectors(uint32_t index, uint32_t count, uint8_t *buf) {
      * But it does not work as desired. The solution is to read 1 sectors
      * successively.
      */
-    uint32_t bytes = 0, status, i;
+    uint32_t bytes = 0, status, i, flags;
     for (; count; ++index, --count) {
-        outb(0xE0 | ((index >> 24) & 0xF), ATA_DRIVE_SELECT);   /* tells drive and first 8 bits of sector index */
+        cli_and_save(flags);                    /* swapping may use the other drive of the channel */
+        outb(drive | ATA_LBA | ((index >> 24) & 0xF), ATA_DRIVE_SELECT);   /* tells drive and first 8 bits of sector index */
         outb(1, ATA_SECTOR_COUNT);              /* 1 sector for multiple times */
         outb((uint8_t)index, ATA_LBA_LOW);      /* tells remaining 24 bits of sector size */
         outb((uint8_t)((index >> 8) & 0xFF), ATA_LBA_MID);
@@ -62,27 +66,30 @@ uint32_t read_ata_sectors(uint32_t index, uint32_t count, uint8_t *buf) {
         for (i = 0; i < (ATA_SECTOR_SIZE >> 1); ++i, bytes += 2, buf += 2) {
             *(uint16_t *)buf = (uint16_t)inw(ATA_DATA);
         }
+        restore_flags(flags);
     }
     return bytes;
 }
 
 /**
- * @brief writes \p count of sectors starting at \p index from \p buf
- * the buffer size should be count * 512 (ATA_SECTOR_SIZE)
+ * @brief writes \p count of sectors starting at \p index of \p drive
+ * from \p buf, the buffer size should be count * 512 (ATA_SECTOR_SIZE)
  * 
+ * @param drive ATA_MASTER_DRIVE or ATA_SLAVE_DRIVE
  * @param index the starting index of the sector to write
  * @param count the count of sectors to write
  * @param buf the source buffer
  * @return count of bytes written
  */
-uint32_t write_ata_sectors(uint32_t index, uint32_t count, const uint8_t *buf) {
+uint32_t write_ata_drive(uint32_t drive, uint32_t index, uint32_t count, const uint8_t *buf) {
     if (!buf || !count || index >= ATA_SECTOR_BOUND) {               /* checks illegal arguments */
         return 0;
     }
 
-    uint32_t bytes = 0, i;
+    uint32_t bytes = 0, i, flags;
     for (; count; ++index, --count) {
-        outb(0xE0 | ((index >> 24) & 0xF), ATA_DRIVE_SELECT);   /* tells drive and first 8 bits of sector index */
+        cli_and_save(flags);                    /* swapping may use the other drive of the channel */
+        outb(drive | ATA_LBA | ((index >> 24) & 0xF), ATA_DRIVE_SELECT);   /* tells drive and first 8 bits of sector index */
         outb(1, ATA_SECTOR_COUNT);              /* 1 sector for multiple times */
         outb((uint8_t)index, ATA_LBA_LOW);      /* tells remaining 24 bits of sector size */
         outb((uint8_t)((index >> 8) & 0xFF), ATA_LBA_MID);
@@ -93,14 +100,82 @@ uint32_t write_ata_sectors(uint32_t index, uint32_t count, const uint8_t *buf) {
 
         for (i = 0; i < (ATA_SECTOR_SIZE >> 1); ++i, bytes += 2, buf += 2) {
             outw(*(uint16_t *)buf, ATA_DATA);
-            outb(ATA_MASTER_DRIVE, ATA_DRIVE_SELECT);           /* flush the cache */
+            outb(drive, ATA_DRIVE_SELECT);                      /* flush the cache */
             outb(ATA_CMD_FLUSH, ATA_STATUS);
             while (inb(ATA_STATUS) & ATA_FLAG_STATUS_BUSY);
         }
+        restore_flags(flags);
     }
     return bytes;
 }
 
+/**
+ * @brief reads \p count of sectors starting at \p index to \p buf
+ * the buffer size should be count * 512 (ATA_SECTOR_SIZE)
+ * 
+ * @param index the starting index of the sector to read
+ * @param count the count of sectors to read
+ * @param buf the destination buffer
+ * @return count of bytes read
+ */
+uint32_t read_ata_sectors(uint32_t index, uint32_t count, uint8_t *buf) {
+    return read_ata_drive(ATA_MASTER_DRIVE, index, count, buf);
+}
+
+/**
+ * @brief writes \p count of sectors starting at \p index from \p buf
+ * the buffer size should be count * 512 (ATA_SECTOR_SIZE)
+ * 
+ * @param index the starting index of the sector to write
+ * @param count the count of sectors to write
+ * @param buf the source buffer
+ * @return count of bytes written
+ */
+uint32_t write_ata_sectors(uint32_t index, uint32_t count, const uint8_t *buf) {
+    return write_ata_drive(ATA_MASTER_DRIVE, index, count, buf);
+}
+
+/**
+ * @brief asks \p drive for its size with IDENTIFY
+ * 
+ * @param drive ATA_MASTER_DRIVE or ATA_SLAVE_DRIVE
+ * @return count of sectors addressable by LBA28, 0 if there is no such drive
+ */
+uint32_t ata_drive_sectors(uint32_t drive) {
+    uint16_t identity[ATA_SECTOR_SIZE >> 1];
+    uint32_t status, i, flags, polls = ATA_POLL_LIMIT;
+
+    cli_and_save(flags);
+    outb(drive, ATA_DRIVE_SELECT);
+    outb(0, ATA_SECTOR_COUNT);
+    outb(0, ATA_LBA_LOW);
+    outb(0, ATA_LBA_MID);
+    outb(0, ATA_LBA_HIGH);
+    outb(ATA_CMD_IDENTIFY, ATA_STATUS);
+
+    do {
+        status = inb(ATA_STATUS);               /* 0 or a floating bus if absent */
+    } while (status != 0xFF && (status & ATA_FLAG_STATUS_BUSY) && --polls);
+    if (!status || status == 0xFF || !polls
+        || inb(ATA_LBA_MID) || inb(ATA_LBA_HIGH)) { /* ATAPI and SATA set the signature */
+        restore_flags(flags);
+        return 0;
+    }
+
+    do {
+        status = inb(ATA_STATUS);
+    } while (!(status & (ATA_FLAG_STATUS_DATA_REQUEST | ATA_FLAG_STATUS_ERROR)) && --polls);
+    if ((status & ATA_FLAG_STATUS_ERROR) || !polls) {
+        restore_flags(flags);
+        return 0;
+    }
+    for (i = 0; i < (ATA_SECTOR_SIZE >> 1); ++i) {
+        identity[i] = (uint16_t)inw(ATA_DATA);
+    }
+    restore_flags(flags);
+    return identity[ATA_IDENTIFY_LBA_SECTORS] | (identity[ATA_IDENTIFY_LBA_SECTORS + 1] << 16);
+}
+
 /**
  * @brief initializes the file system
  * 
@@ -241,6 +316,8 @@ int32_t write_data(uint32_t inode, uint32_t offset, const uint8_t *buf, uint32_t
         return -1;
     }
 
+    image_invalidate(inode);                        /* the cached program is outdated */
+
     inode_t *in = inode_blocks + inode;
     if (offset > in->file_size) {                   /* largest = append */
         return 0;
@@ -8,6 +8,9 @@
 #define FS_MAX_LEN 32
 #define DENTRY_COUNT 63
 
+#define ATA_MASTER_DRIVE    0xA0    /* the disk with the file system */
+#define ATA_SLAVE_DRIVE     0xB0    /* the second disk of the primary channel */
+
 typedef struct {
     uint32_t file_size;             /* in bytes */
     uint32_t data_blocks[1023];     /* (4096 - sizeof(uint32_t)) / 4 */
@@ -39,6 +42,38 @@ data_block_t *data_blocks;
 uint8_t inode_bitmap[64];
 uint8_t data_block_bitmap[64];
 
+/**
+ * @brief reads \p count of sectors starting at \p index of \p drive
+ * to \p buf, the buffer size should be count * 512 (ATA_SECTOR_SIZE)
+ * 
+ * @param drive ATA_MASTER_DRIVE or ATA_SLAVE_DRIVE
+ * @param index the starting index of the sector to read
+ * @param count the count of sectors to read
+ * @param buf the destination buffer
+ * @return count of bytes read
+ */
+uint32_t read_ata_drive(uint32_t drive, uint32_t index, uint32_t count, uint8_t *buf);
+
+/**
+ * @brief writes \p count of sectors starting at \p index of \p drive
+ * from \p buf, the buffer size should be count * 512 (ATA_SECTOR_SIZE)
+ * 
+ * @param drive ATA_MASTER_DRIVE or ATA_SLAVE_DRIVE
+ * @param index the starting index of the sector to write
+ * @param count the count of sectors to write
+ * @param buf the source buffer
+ * @return count of bytes written
+ */
+uint32_t write_ata_drive(uint32_t drive, uint32_t index, uint32_t count, const uint8_t *buf);
+
+/**
+ * @brief asks \p drive for its size with IDENTIFY
+ * 
+ * @param drive ATA_MASTER_DRIVE or ATA_SLAVE_DRIVE
+ * @return count of sectors addressable by LBA28, 0 if there is no such drive
+ */
+uint32_t ata_drive_sectors(uint32_t drive);
+
 /**
  * @brief reads \p count of sectors starting at \p index to \p buf
  * the buffer size should be count * 512 (ATA_SECTOR_SIZE)
@@ -0,0 +1,124 @@
+#include "fpu.h"
+
+#define CR0_MP                  0x00000002          /* wait/fwait traps when TS is set */
+#define CR0_EM                  0x00000004          /* emulates the x87, must be off for SSE */
+#define CR0_TS                  0x00000008          /* set on every switch, the next use traps */
+#define CR4_OSFXSR              0x00000200          /* fxsave/fxrstor and SSE are available */
+#define CR4_OSXMMEXCPT          0x00000400          /* SIMD errors raise exception 0x13 */
+
+#define MXCSR_DEFAULT           0x1F80              /* every SIMD exception masked */
+
+static pcb_t *fpu_owner = NULL;                     /* process whose state is in the registers */
+
+/* sets CR0.TS, the next FPU or SSE instruction raises exception 0x07 */
+static inline void fpu_trap_next() {
+    asm volatile (
+        "movl %%cr0, %%eax\n"
+        "orl  %0, %%eax\n"
+        "movl %%eax, %%cr0\n"
+        :
+        : "i"(CR0_TS)
+        : "eax"
+    );
+}
+
+/**
+ * @brief enables x87 and SSE for user programs, with the first use of
+ * every process trapping to \c fpu_handler
+ */
+void fpu_init() {
+    asm volatile (
+        "movl %%cr0, %%eax\n"
+        "andl %0, %%eax\n"
+        "orl  %1, %%eax\n"
+        "movl %%eax, %%cr0\n"
+        "movl %%cr4, %%eax\n"
+        "orl  %2, %%eax\n"
+        "movl %%eax, %%cr4\n"
+        :
+        : "i"(~CR0_EM), "i"(CR0_MP | CR0_TS), "i"(CR4_OSFXSR | CR4_OSXMMEXCPT)
+        : "eax"
+    );
+    fpu_owner = NULL;
+}
+
+/**
+ * @brief lets the FPU run without a trap only if \p next still owns
+ * the registers, called as \p next becomes the running process
+ *
+ * @param next the process to run
+ */
+void fpu_switch(pcb_t *next) {
+    if (next == fpu_owner) {
+        asm volatile ("clts");
+    } else {
+        fpu_trap_next();
+    }
+}
+
+/**
+ * @brief handles the device-not-available exception: saves the state
+ * of the last owner and loads the state of the current process
+ */
+void fpu_handler() {
+    pcb_t *curr = get_current_pcb();
+    uint32_t mxcsr = MXCSR_DEFAULT;
+
+    asm volatile ("clts");
+    if (fpu_owner == curr) {
+        return;
+    }
+    if (fpu_owner) {
+        asm volatile ("fxsave %0" : "=m"(fpu_owner->fpu_state));
+    }
+    if (curr->fpu_used) {
+        asm volatile ("fxrstor %0" : : "m"(curr->fpu_state));
+    } else {
+        asm volatile (                              /* the first use starts clean */
+            "fninit\n"
+            "ldmxcsr %0\n"
+            :
+            : "m"(mxcsr)
+        );
+        curr->fpu_used = 1;
+    }
+    fpu_owner = curr;
+}
+
+/**
+ * @brief gives \p child the FPU state of \p parent, as of now
+ *
+ * @param parent the forking process
+ * @param child the new process
+ */
+void fpu_fork(pcb_t *parent, pcb_t *child) {
+    uint32_t flags;
+    cli_and_save(flags);
+    if (fpu_owner == parent) {                      /* the registers are newer than the pcb */
+        asm volatile (
+            "clts\n"
+            "fxsave %0\n"
+            : "=m"(parent->fpu_state)
+        );
+    }
+    child->fpu_used = parent->fpu_used;
+    memcpy(child->fpu_state, parent->fpu_state, FPU_STATE_SIZE);
+    restore_flags(flags);
+}
+
+/**
+ * @brief drops the FPU state of \p pcb, whose program is gone; the
+ * next use starts from the initial state
+ *
+ * @param pcb the process
+ */
+void fpu_release(pcb_t *pcb) {
+    uint32_t flags;
+    cli_and_save(flags);
+    if (fpu_owner == pcb) {
+        fpu_owner = NULL;
+        fpu_trap_next();
+    }
+    pcb->fpu_used = 0;
+    restore_flags(flags);
+}
@@ -0,0 +1,42 @@
+#ifndef _FPU_H
+#define _FPU_H
+
+#include "lib.h"
+
+/**
+ * @brief enables x87 and SSE for user programs, with the first use of
+ * every process trapping to \c fpu_handler
+ */
+void fpu_init();
+
+/**
+ * @brief lets the FPU run without a trap only if \p next still owns
+ * the registers, called as \p next becomes the running process
+ *
+ * @param next the process to run
+ */
+void fpu_switch(pcb_t *next);
+
+/**
+ * @brief handles the device-not-available exception: saves the state
+ * of the last owner and loads the state of the current process
+ */
+void fpu_handler();
+
+/**
+ * @brief gives \p child the FPU state of \p parent, as of now
+ *
+ * @param parent the forking process
+ * @param child the new process
+ */
+void fpu_fork(pcb_t *parent, pcb_t *child);
+
+/**
+ * @brief drops the FPU state of \p pcb, whose program is gone; the
+ * next use starts from the initial state
+ *
+ * @param pcb the process
+ */
+void fpu_release(pcb_t *pcb);
+
+#endif
@@ -0,0 +1,154 @@
+#include "frame.h"
+#include "swap.h"
+
+#define FRAME_INDEX(addr)       ((addr) / FRAME_SIZE)
+
+static uint16_t frame_ref_counts[BUDDY_PAGE_COUNT]; /* sharers of each frame, 0 if free */
+static uint32_t zero_pool[FRAME_ZERO_HIGH];         /* free frames already cleared */
+static uint32_t zero_count = 0;                     /* frames in the pool */
+static uint32_t zero_filling = 0;                   /* refilling from FRAME_ZERO_LOW to FRAME_ZERO_HIGH */
+
+/**
+ * @brief clears the reference counts; frames are single pages of the
+ * buddy allocator, which is set up before
+ */
+void frame_init() {
+    memset(frame_ref_counts, 0, sizeof(frame_ref_counts));
+    zero_count = 0;
+    zero_filling = 0;
+}
+
+/**
+ * @brief takes a free 4 KB frame, with one reference; idle user pages
+ * are swapped out first if memory runs low
+ *
+ * @return the physical address of the frame, 0 if there is none left;
+ * the contents are not cleared
+ */
+uint32_t frame_alloc() {
+    uint32_t flags, addr;
+    cli_and_save(flags);
+    if (buddy_free_pages() < FRAME_LOW_PAGES) {
+        swap_reclaim(FRAME_RECLAIM_BATCH);          /* leaves larger blocks for stacks and slabs */
+    }
+    addr = (uint32_t)get_free_pages(0);
+    if (!addr && zero_count) {
+        addr = zero_pool[--zero_count];             /* zeroed frames are free frames too */
+    }
+    if (addr) {                                     /* 0 if out of memory */
+        frame_ref_counts[FRAME_INDEX(addr)] = 1;
+    }
+    restore_flags(flags);
+    return addr;
+}
+
+/**
+ * @brief takes a 4 KB frame filled with zeros, with one reference,
+ * from the pool zeroed by the idle task if it has one
+ *
+ * @return the physical address of the frame, 0 if there is none left
+ */
+uint32_t frame_alloc_zeroed() {
+    uint32_t flags, addr;
+    cli_and_save(flags);
+    if (zero_count) {
+        addr = zero_pool[--zero_count];
+        frame_ref_counts[FRAME_INDEX(addr)] = 1;
+        restore_flags(flags);
+        return addr;
+    }
+    restore_flags(flags);
+
+    if ((addr = frame_alloc())) {
+        memset((void *)addr, 0, FRAME_SIZE);        /* the pool ran dry, clears it now */
+    }
+    return addr;
+}
+
+/**
+ * @brief takes one more reference of the frame at \p addr, which is
+ * then shared
+ *
+ * @param addr the physical address of an allocated frame
+ */
+void frame_hold(uint32_t addr) {
+    uint32_t flags;
+    cli_and_save(flags);
+    ++frame_ref_counts[FRAME_INDEX(addr)];
+    restore_flags(flags);
+}
+
+/**
+ * @brief releases one reference of the frame at \p addr, which is free
+ * again with the last one
+ *
+ * @param addr the physical address of an allocated frame
+ */
+void frame_put(uint32_t addr) {
+    uint32_t flags, index = FRAME_INDEX(addr);
+    cli_and_save(flags);
+    if (frame_ref_counts[index] && !--frame_ref_counts[index]) {
+        free_pages((void *)addr, 0);
+    }
+    restore_flags(flags);
+}
+
+/**
+ * @brief counts the references of the frame at \p addr
+ *
+ * @param addr the physical address of a frame
+ * @return number of references, 0 if the frame is free
+ */
+uint32_t frame_refs(uint32_t addr) {
+    if (addr >= BUDDY_LIMIT) {
+        return 0;
+    }
+    return frame_ref_counts[FRAME_INDEX(addr)];
+}
+
+/**
+ * @brief counts the frames that are free, zeroed ones included
+ *
+ * @return number of free frames
+ */
+uint32_t frame_free_count() {
+    return buddy_free_pages() + zero_count;
+}
+
+/**
+ * @brief checks if the pool of zeroed frames should be filled: once
+ * below FRAME_ZERO_LOW until FRAME_ZERO_HIGH, while memory is not low
+ *
+ * @return 1 if a frame should be zeroed, 0 if not
+ */
+int32_t frame_zero_wanted() {
+    if (zero_count < FRAME_ZERO_LOW) {
+        zero_filling = 1;
+    } else if (zero_count >= FRAME_ZERO_HIGH) {
+        zero_filling = 0;
+    }
+    return zero_filling && buddy_free_pages() >= FRAME_LOW_PAGES;  /* never swaps to fill the pool */
+}
+
+/**
+ * @brief zeroes one free frame and adds it to the pool, called by the
+ * idle task with interrupts enabled
+ */
+void frame_zero_one() {
+    uint32_t flags, addr;
+    cli_and_save(flags);
+    addr = (uint32_t)get_free_pages(0);             /* belongs to no one while it is cleared */
+    restore_flags(flags);
+    if (!addr) {
+        return;
+    }
+
+    memset((void *)addr, 0, FRAME_SIZE);            /* the pool is identity mapped */
+    cli_and_save(flags);
+    if (zero_count < FRAME_ZERO_HIGH) {
+        zero_pool[zero_count++] = addr;
+    } else {
+        free_pages((void *)addr, 0);                /* never above the high watermark */
+    }
+    restore_flags(flags);
+}
@@ -0,0 +1,81 @@
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include "lib.h"
+#include "buddy.h"
+
+#define FRAME_SIZE              BUDDY_PAGE_SIZE
+#define FRAME_LOW_PAGES         64                  /* free pages below which user pages are swapped out */
+#define FRAME_RECLAIM_BATCH     16                  /* pages swapped out at a time */
+#define FRAME_ZERO_LOW          16                  /* zeroed frames below which the idle task refills */
+#define FRAME_ZERO_HIGH         64                  /* zeroed frames kept at most */
+
+/**
+ * @brief clears the reference counts; frames are single pages of the
+ * buddy allocator, which is set up before
+ */
+void frame_init();
+
+/**
+ * @brief takes a free 4 KB frame, with one reference; idle user pages
+ * are swapped out first if memory runs low
+ *
+ * @return the physical address of the frame, 0 if there is none left;
+ * the contents are not cleared
+ */
+uint32_t frame_alloc();
+
+/**
+ * @brief takes a 4 KB frame filled with zeros, with one reference,
+ * from the pool zeroed by the idle task if it has one
+ *
+ * @return the physical address of the frame, 0 if there is none left
+ */
+uint32_t frame_alloc_zeroed();
+
+/**
+ * @brief takes one more reference of the frame at \p addr, which is
+ * then shared
+ *
+ * @param addr the physical address of an allocated frame
+ */
+void frame_hold(uint32_t addr);
+
+/**
+ * @brief releases one reference of the frame at \p addr, which is free
+ * again with the last one
+ *
+ * @param addr the physical address of an allocated frame
+ */
+void frame_put(uint32_t addr);
+
+/**
+ * @brief counts the references of the frame at \p addr
+ *
+ * @param addr the physical address of a frame
+ * @return number of references, 0 if the frame is free
+ */
+uint32_t frame_refs(uint32_t addr);
+
+/**
+ * @brief counts the frames that are free, zeroed ones included
+ *
+ * @return number of free frames
+ */
+uint32_t frame_free_count();
+
+/**
+ * @brief checks if the pool of zeroed frames should be filled: once
+ * below FRAME_ZERO_LOW until FRAME_ZERO_HIGH, while memory is not low
+ *
+ * @return 1 if a frame should be zeroed, 0 if not
+ */
+int32_t frame_zero_wanted();
+
+/**
+ * @brief zeroes one free frame and adds it to the pool, called by the
+ * idle task with interrupts enabled
+ */
+void frame_zero_one();
+
+#endif
@@ -2,6 +2,7 @@
 #include "keyboard.h"
 #include "rtc.h"
 #include "syscall.h"
+#include "paging.h"
 
 #define PIT_INTR_INDEX 0x20
 
@@ -30,6 +31,8 @@ extern void keyboard_int_wrapper();
 extern void rtc_int_wrapper();
 extern void pit_int_wrapper();
 extern void system_call_wrapper();
+extern void page_fault_wrapper();
+extern void device_not_available_wrapper();
 
 uint8_t exception_occurred = 0;
 
@@ -75,12 +78,6 @@ void exception_invalid_opcode(){
     halt(255);
 }
 
-void exception_device_not_available(){
-    printf(" Exception 0x07: Device Not Available\n");
-    exception_occurred = 1;
-    halt(255);
-}
-
 void exception_double_fault(){
     printf(" Exception 0x08: Double Fault\n");
     exception_occurred = 1;
@@ -115,12 +112,21 @@ void exception_general_protection(){
     exception_occurred = 1;
     halt(255);
 }
-void exception_page_fault(){
+/**
+ * @brief handles page faults: pages of user programs are loaded on
+ * their first touch, other faults kill the process
+ *
+ * @param error_code the error code pushed by the processor
+ */
+void exception_page_fault(uint32_t error_code){
     uint32_t page_fault_linear_addr;
     asm volatile (
         "movl %%cr2, %0" : "=r" (page_fault_linear_addr)
                          :
     );
+    if (paging_fault(page_fault_linear_addr, error_code) == 0) {
+        return;                                     /* retries the faulting instruction */
+    }
     printf(" Exception 0x0E: Page Fault (at 0x%x)\n", page_fault_linear_addr);
     exception_occurred = 1;
     halt(255);
@@ -175,14 +181,14 @@ void idt_init() {
     INIT_EXCEPTION(0x04, exception_overflow);
     INIT_EXCEPTION(0x05, exception_bound_range_exceeded);
     INIT_EXCEPTION(0x06, exception_invalid_opcode);
-    INIT_EXCEPTION(0x07, exception_device_not_available);
+    INIT_INTERRUPT(0x07, device_not_available_wrapper);   /* loads the FPU state of the process */
     INIT_EXCEPTION(0x08, exception_double_fault);
     INIT_EXCEPTION(0x09, exception_segment_overrun);
     INIT_EXCEPTION(0x0A, exception_invalid_tss);
     INIT_EXCEPTION(0x0B, exception_segment_not_present);
     INIT_EXCEPTION(0x0C, exception_stack_segment_fault);
     INIT_EXCEPTION(0x0D, exception_general_protection);
-    INIT_EXCEPTION(0x0E, exception_page_fault);
+    INIT_INTERRUPT(0x0E, page_fault_wrapper);     /* no preemption while filling the page */
     INIT_EXCEPTION(0x0F, exception_reserved);
     INIT_EXCEPTION(0x10, exception_x87_floating_point_error);
     INIT_EXCEPTION(0x11, exception_alignment_check);
@@ -0,0 +1,183 @@
+#include "image.h"
+#include "paging.h"
+#include "filesys.h"
+#include "syscall.h"
+#include "buddy.h"
+
+#define PAGE_SIZE               0x1000
+#define PAGE_UP(x)              (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+static image_t images[IMAGE_CACHE_MAX];
+static uint32_t image_count = 0;                    /* slots in use, by the size of memory */
+static uint32_t image_clock = 0;                    /* increases on every lookup */
+
+/**
+ * @brief sizes the cache by the memory found at boot, takes the memory
+ * of every slot from the buddy allocator and empties all slots
+ */
+void image_cache_init() {
+    uint32_t i;
+    image_count = buddy_total_pages() / (IMAGE_CACHE_RAM_PER_SLOT / PAGE_SIZE);
+    if (image_count < IMAGE_CACHE_MIN) {
+        image_count = IMAGE_CACHE_MIN;
+    } else if (image_count > IMAGE_CACHE_MAX) {
+        image_count = IMAGE_CACHE_MAX;
+    }
+    for (i = 0; i < image_count; ++i) {
+        images[i].present = 0;
+        images[i].stale = 0;
+        images[i].refs = 0;
+        images[i].last_used = 0;
+        images[i].data = get_free_pages(IMAGE_CACHE_SLOT_ORDER);   /* identity mapped */
+    }
+}
+
+/**
+ * @brief finds the image of the executable at \p inode, loads it to
+ * the cache if it is not resident
+ *
+ * @param inode the inode of the executable
+ * @return the image with one more reference, or NULL if the file is
+ * not executable or cannot be cached
+ */
+image_t *image_get(uint32_t inode) {
+    uint32_t flags, i;
+    image_t *image, *victim = NULL;
+    elf_t elf;
+
+    cli_and_save(flags);
+    for (i = 0, image = images; i < image_count; ++i, ++image) {
+        if (image->present && !image->stale && image->inode == inode) {
+            ++image->refs;                              /* cache hit */
+            image->last_used = ++image_clock;
+            restore_flags(flags);
+            return image;
+        }
+        if (image->data && !image->refs && (!victim || image->last_used < victim->last_used)) {
+            victim = image;                             /* least recently used, unreferenced */
+        }
+    }
+
+    if (!victim                                         /* every slot is running some program */
+        || inode >= boot_block->inode_count
+        || inode_blocks[inode].file_size > IMAGE_CACHE_SLOT_SIZE
+        || elf_parse(inode, &elf) == -1) {
+        restore_flags(flags);
+        return NULL;
+    }
+
+    victim->present = 1;
+    victim->stale = 0;
+    victim->inode = inode;
+    victim->elf = elf;
+    victim->size = read_data(inode, 0, victim->data, IMAGE_CACHE_SLOT_SIZE);
+    memset(victim->data + victim->size, 0,              /* the last shared page ends with zeros */
+           PAGE_UP(victim->size) - victim->size);
+    victim->refs = 1;
+    victim->last_used = ++image_clock;
+    restore_flags(flags);
+    return victim;
+}
+
+/**
+ * @brief releases one reference of \p image
+ *
+ * @param image the image returned by \c image_get
+ */
+void image_put(image_t *image) {
+    uint32_t flags;
+    if (!image) {
+        return;
+    }
+
+    cli_and_save(flags);
+    if (image->refs && !--image->refs && image->stale) {
+        image->present = 0;                             /* the outdated copy is no longer used */
+        image->stale = 0;
+        image->last_used = 0;
+    }
+    restore_flags(flags);
+}
+
+/**
+ * @brief takes one more reference of \p image, which is already held
+ *
+ * @param image the image returned by \c image_get, or NULL
+ */
+void image_hold(image_t *image) {
+    uint32_t flags;
+    if (!image) {
+        return;
+    }
+
+    cli_and_save(flags);
+    ++image->refs;
+    restore_flags(flags);
+}
+
+/**
+ * @brief drops the cached image of \p inode, called as the file is
+ * written or deleted
+ *
+ * @param inode the inode of the changed file
+ */
+void image_invalidate(uint32_t inode) {
+    uint32_t flags, i;
+    image_t *image;
+
+    cli_and_save(flags);
+    for (i = 0, image = images; i < image_count; ++i, ++image) {
+        if (image->present && image->inode == inode) {
+            if (image->refs) {
+                image->stale = 1;                       /* still used, released by image_put */
+            } else {
+                image->present = 0;
+                image->last_used = 0;
+            }
+        }
+    }
+    restore_flags(flags);
+}
+
+/**
+ * @brief checks if the file at \p inode is executable and gets its
+ * segments and entry point
+ *
+ * @param inode the inode of the file
+ * @param elf the layout returned
+ * @return 0 if executable, -1 if not
+ */
+int32_t image_elf(uint32_t inode, elf_t *elf) {
+    image_t *image = image_get(inode);
+    if (image) {
+        *elf = image->elf;                          /* parsed as it was loaded */
+        image_put(image);
+        return 0;
+    }
+    return elf_parse(inode, elf);                   /* not cacheable, asks the file system */
+}
+
+/**
+ * @brief reads \p len bytes at \p offset of the program at \p inode to
+ * \p buf, from the resident \p image if there is one
+ *
+ * @param image the cached image of the program, or NULL
+ * @param inode the inode of the program
+ * @param offset the starting position to read
+ * @param buf the destination buffer
+ * @param len the capacity of the buffer
+ * @return number of bytes read, 0 beyond the end of file, -1 if fail
+ */
+int32_t image_read(image_t *image, uint32_t inode, uint32_t offset, uint8_t *buf, uint32_t len) {
+    if (!image) {
+        return read_data(inode, offset, buf, len);      /* not cacheable, asks the file system */
+    }
+    if (offset >= image->size) {
+        return 0;
+    }
+    if (len > image->size - offset) {
+        len = image->size - offset;
+    }
+    memcpy(buf, image->data + offset, len);
+    return len;
+}
@@ -0,0 +1,87 @@
+#ifndef _IMAGE_H
+#define _IMAGE_H
+
+#include "lib.h"
+
+#define IMAGE_CACHE_MAX         32                  /* most images kept resident */
+#define IMAGE_CACHE_MIN         4                   /* images kept resident on the smallest machine */
+#define IMAGE_CACHE_RAM_PER_SLOT    0x800000        /* one slot for every 8 MB of memory */
+#define IMAGE_CACHE_SLOT_ORDER  7                   /* each slot is a block from get_free_pages */
+#define IMAGE_CACHE_SLOT_SIZE   (0x1000 << IMAGE_CACHE_SLOT_ORDER)
+
+/**
+ * @brief \c image_t is a resident, pristine copy of an executable file
+ */
+typedef struct image_t {
+    uint32_t present;           /* the slot holds a loaded image */
+    uint32_t stale;             /* the file changed after loading, dropped as the last user leaves */
+    uint32_t inode;             /* the file the image was loaded from */
+    uint32_t size;              /* size of the file in bytes */
+    elf_t elf;                  /* segments read from the ELF headers */
+    uint32_t refs;              /* number of users holding the image */
+    uint32_t last_used;         /* stamp for least-recently-used eviction */
+    uint8_t *data;              /* the copy of the file, IMAGE_CACHE_SLOT_SIZE bytes, NULL if unavailable */
+} image_t;
+
+/**
+ * @brief sizes the cache by the memory found at boot, takes the memory
+ * of every slot from the buddy allocator and empties all slots
+ */
+void image_cache_init();
+
+/**
+ * @brief finds the image of the executable at \p inode, loads it to
+ * the cache if it is not resident
+ *
+ * @param inode the inode of the executable
+ * @return the image with one more reference, or NULL if the file is
+ * not executable or cannot be cached
+ */
+image_t *image_get(uint32_t inode);
+
+/**
+ * @brief releases one reference of \p image
+ *
+ * @param image the image returned by \c image_get
+ */
+void image_put(image_t *image);
+
+/**
+ * @brief takes one more reference of \p image, which is already held
+ *
+ * @param image the image returned by \c image_get, or NULL
+ */
+void image_hold(image_t *image);
+
+/**
+ * @brief drops the cached image of \p inode, called as the file is
+ * written or deleted
+ *
+ * @param inode the inode of the changed file
+ */
+void image_invalidate(uint32_t inode);
+
+/**
+ * @brief checks if the file at \p inode is executable and gets its
+ * segments and entry point
+ *
+ * @param inode the inode of the file
+ * @param elf the layout returned
+ * @return 0 if executable, -1 if not
+ */
+int32_t image_elf(uint32_t inode, elf_t *elf);
+
+/**
+ * @brief reads \p len bytes at \p offset of the program at \p inode to
+ * \p buf, from the resident \p image if there is one
+ *
+ * @param image the cached image of the program, or NULL
+ * @param inode the inode of the program
+ * @param offset the starting position to read
+ * @param buf the destination buffer
+ * @param len the capacity of the buffer
+ * @return number of bytes read, 0 beyond the end of file, -1 if fail
+ */
+int32_t image_read(image_t *image, uint32_t inode, uint32_t offset, uint8_t *buf, uint32_t len);
+
+#endif
@@ -11,6 +11,12 @@
 #include "sched.h"
 #include "debug.h"
 #include "malloc.h"
+#include "image.h"
+#include "buddy.h"
+#include "frame.h"
+#include "proc.h"
+#include "swap.h"
+#include "fpu.h"
 #include "tests.h"
 
 #include "i8259.h"
@@ -146,9 +152,17 @@ void entry(unsigned long magic, unsigned long addr) {
     }
 
     /* Init the interrupt */
+    buddy_init(mbi);                            /* reads the memory map before paging hides it */
+    printf("memory: %u KB managed up to 0x%#x\n", buddy_total_pages() * 4, buddy_end());
     paging_init();
+    frame_init();
+    swap_init();
+    printf("swap: %u KB on the slave drive\n", swap_total_pages() * 4);
     kmalloc_init();
+    proc_init();
+    image_cache_init();
     idt_init();
+    fpu_init();
     i8259_init();
 
     keyboard_init();
@@ -1,8 +1,12 @@
 #include "keyboard.h"
 #include "syscall.h"
 #include "i8259.h"
+#include "sched.h"
+#include "proc.h"
+#include "softirq.h"
 
 #define KEYBOARD_PORT       0x60    /* the port for keyboard */
+#define KEYBOARD_BUFFER_SIZE 64     /* scan codes waiting for the bottom half, a power of 2 */
 
 #define SC_ESCAPE           0x01
 #define SC_BACKSPACE        0x0E
@@ -62,6 +66,13 @@ char visible_scancode_map_shifted[] = {
     '\0', ' '
 };
 
+static uint8_t scancodes[KEYBOARD_BUFFER_SIZE];     /* read by the top half, not yet handled */
+static uint32_t scancode_head = 0;
+static uint32_t scancode_tail = 0;
+
+static void keyboard_bottom_half(uint32_t data);
+static tasklet_t keyboard_tasklet = { keyboard_bottom_half, 0, 0, NULL };
+
 uint8_t input[MAX_TERMINAL];            /* records user typed letters*/
 uint32_t length;                        /* records length of input */
 volatile uint32_t input_in_progress;    /* nonzero if user is typing */
@@ -74,11 +85,25 @@ void keyboard_init() {
 }
 
 /**
- * @brief handles keyboard interrupts, based on scan code
+ * @brief handles keyboard interrupts: the scan code is only recorded
+ * here, and handled by the bottom half
  */
 void keyboard_handler() {
-    unsigned char scancode = inb(KEYBOARD_PORT);
-    
+    uint8_t scancode = inb(KEYBOARD_PORT);
+    if (scancode_tail - scancode_head < KEYBOARD_BUFFER_SIZE) {    /* drops keys typed too fast */
+        scancodes[scancode_tail++ % KEYBOARD_BUFFER_SIZE] = scancode;
+    }
+    tasklet_schedule(&keyboard_tasklet);
+    send_eoi(KEYBOARD_IRQ);
+}
+
+/**
+ * @brief echoes and records a key, switches terminals or halts the
+ * foreground program, based on scan code
+ * 
+ * @param scancode the scan code read from the keyboard
+ */
+static void keyboard_process(uint8_t scancode) {
     /* shift */
     if (scancode == SC_LEFTSHIFT) {
         keyboard_bitmap |= KBF_LEFTSHIFT;
@@ -117,6 +142,7 @@ void keyboard_handler() {
     else if (scancode == SC_ENTER) {
         echo('\n');
         terms[shown_term_id].input.in_progress = 0;
+        wait_queue_wake_all(&terms[shown_term_id].input.readers);
     }
     /* switch terminal */
     else if (scancode >= 0x3B && scancode <= 0x3D) {
@@ -130,6 +156,8 @@ void keyboard_handler() {
                     clear();
                 } else if (scancode == 0x2E) {
                     terms[shown_term_id].input.to_be_halt = 1;
+                    wait_queue_wake_all(&terms[shown_term_id].input.readers);
+                    timer_wake(proc_get(terms[shown_term_id].pid));
                 }
             } else {
                 char ch = (keyboard_bitmap & KBF_LEFTSHIFT || keyboard_bitmap & KBF_RIGHTSHIFT
@@ -141,6 +169,25 @@ void keyboard_handler() {
             }
         }
     }
+}
 
-    send_eoi(KEYBOARD_IRQ);
+/**
+ * @brief bottom half of the keyboard, handles the recorded scan codes
+ * in order
+ * 
+ * @param data [ignored]
+ */
+static void keyboard_bottom_half(uint32_t data) {
+    uint32_t flags;
+    uint8_t scancode;
+    while (1) {
+        cli_and_save(flags);
+        if (scancode_head == scancode_tail) {
+            restore_flags(flags);
+            return;
+        }
+        scancode = scancodes[scancode_head++ % KEYBOARD_BUFFER_SIZE];
+        restore_flags(flags);
+        keyboard_process(scancode);
+    }
 }
@@ -12,7 +12,8 @@
 void keyboard_init();
 
 /**
- * @brief handles keyboard interrupts, based on scan code
+ * @brief handles keyboard interrupts: the scan code is only recorded
+ * here, and handled by the bottom half
  */
 void keyboard_handler();
 
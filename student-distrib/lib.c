@@ -21,7 +21,7 @@ pcb_t *get_current_pcb() {
     asm volatile (
         "movl %%esp, %0":"=r"(esp)
     );
-    return (pcb_t *)(esp & 0x7FE000);
+    return (pcb_t *)(esp & ~(KERNEL_STACK_SIZE - 1));  /* pcb is at the bottom of the stack */
 }
 
 /* void clear(void);
@@ -251,7 +251,7 @@ void putc(uint8_t c) {
         // screen_x %= NUM_COLS;
         // screen_y = (screen_y + (screen_x / NUM_COLS)) % NUM_ROWS;
     }
-    if (get_current_pcb()->pid == terms[shown_term_id].pid) {
+    if (active_term_id == shown_term_id) {
         terms[shown_term_id].cursor.x = screen_x;
         terms[shown_term_id].cursor.y = screen_y;
         set_cursor_pos(screen_x, screen_y);
@@ -318,51 +318,18 @@ void switch_terminal(uint32_t next_id) {
         return;
     }
 
-    cli();
+    uint32_t flags;
+    cli_and_save(flags);
     memcpy((void *)(VIDEO + (shown_term_id + 2) * VIDEO_SIZE),
            (const void *)(VIDEO + VIDEO_SIZE), VIDEO_SIZE);
     memcpy((void *)(VIDEO + VIDEO_SIZE),
            (const void *)(VIDEO + (next_id + 2) * VIDEO_SIZE), VIDEO_SIZE);
-           
-    get_screen_coordinate(&terms[active_term_id].cursor.x, &terms[active_term_id].cursor.y);
-    page_table_kernel_vidmem[VIDMEM_INDEX].page_base_address = VIDMEM_INDEX;
-    page_table_user_vidmem[VIDMEM_INDEX].page_base_address = VIDMEM_INDEX;
-    set_screen_coordinate(terms[next_id].cursor.x, terms[next_id].cursor.y);
+    shown_term_id = next_id;
     set_cursor_pos(terms[next_id].cursor.x, terms[next_id].cursor.y);
 
-    asm volatile (                                      /* flushes the TLB */
-        "movl %%cr3, %%eax\n"
-        "movl %%eax, %%cr3\n"
-        :::"eax"
-    );
-
-    pcb_t *curr = get_current_pcb(), *next = pcbs[terms[next_id].pid];
-    active_term_id = shown_term_id = next_id;
-
-    asm volatile (
-        "movl %%ebp, %0\n"
-        : "=r"(curr->ebp)
-    );
-
-    curr->esp0 = tss.esp0;
-    tss.esp0 = next->esp0;
-    page_directories[USER_ENTRY].MB.page_base_address = 2 + next->pid;
-    page_table_user_vidmem[VIDMEM_INDEX].present = next->vidmap;
-    
-    asm volatile (                                      /* flushes the TLB */
-        "movl %%cr3, %%eax\n"
-        "movl %%eax, %%cr3\n"
-        :::"eax"
-    );
-
-    asm volatile (
-        "movl %0, %%ebp\n"
-        "sti\n"
-        "leave\n"
-        "ret\n"
-        : 
-        : "r" (next->ebp)
-    );
+    /* the running process keeps running, only its video memory moves */
+    paging_set_vidmem(active_term_id);
+    restore_flags(flags);
 }
 
 /* int8_t* itoa(uint32_t value, int8_t* buf, int32_t radix);
@@ -7,6 +7,7 @@
 
 #include "types.h"
 #include "x86_desc.h"
+#include "elf.h"
 
 /**
  * @brief \c file_operations_t stores function pointers to some sepcific type of files.
@@ -28,6 +29,25 @@ typedef struct file_t {
     uint32_t present;
 } file_t;
 
+/**
+ * @brief \c wait_queue_t holds processes sleeping until an event
+ */
+typedef struct wait_queue_t {
+    struct pcb_t *head;         /* the first to sleep */
+    struct pcb_t *tail;         /* the last to sleep */
+} wait_queue_t;
+
+#define FPU_STATE_SIZE      512                 /* bytes stored by fxsave */
+#define SHM_PER_PROCESS     4                   /* shared memory segments attached at once */
+
+/**
+ * @brief \c shm_map_t records a shared memory segment attached to a process
+ */
+typedef struct shm_map_t {
+    uint32_t id;                /* the segment */
+    uint32_t addr;              /* where it is mapped, 0 if the entry is unused */
+} shm_map_t;
+
 typedef struct pcb_t {
     uint8_t present;
     uint8_t vidmap;
@@ -36,12 +56,42 @@ typedef struct pcb_t {
     uint32_t rtc_curr;
     uint32_t rtc_rate;
     int32_t pid;
+    uint8_t state;              /* PROC_RUNNING, PROC_READY, PROC_BLOCKED or PROC_ZOMBIE */
+    uint8_t blocked;            /* what a PROC_BLOCKED process waits for */
+    uint8_t priority;           /* level in the feedback queue, 0 runs first */
+    uint8_t ticks;              /* time slices used at this level */
+    uint8_t forked;             /* created by fork(), no execute() frame to return to */
+    uint8_t fpu_used;           /* fpu_state holds registers of the program */
+    uint8_t term_id;            /* terminal the process reads from and writes to */
+    int32_t exit_status;        /* status reported to wait() */
     struct pcb_t *parent;       /* parent's pcb */
+    struct pcb_t *children;     /* first child, the others follow by sibling links */
+    struct pcb_t *sibling_next; /* next child of the same parent */
+    struct pcb_t *sibling_prev; /* previous child of the same parent */
+    struct pcb_t *next;         /* next live process, the list is circular */
+    struct pcb_t *prev;         /* previous live process */
+    struct pcb_t *run_next;     /* next process in the run queue */
+    struct pcb_t *run_prev;     /* previous process in the run queue */
+    struct pcb_t *wait_next;    /* next process on the same wait queue */
+    struct pcb_t *timer_next;   /* next sleeper, with a later or equal deadline */
+    uint32_t wake_time;         /* deadline of the sleep in milliseconds */
+    struct pcb_t *rtc_next;     /* next process with RTC opened */
+    struct pcb_t *rtc_prev;     /* previous process with RTC opened */
     uint32_t ebp;               /* ebp for scheduling */
     uint32_t parent_ebp;        /* parent's ebp as the program quit */
+    pde_t *page_directory;      /* the page directory loaded to CR3, from the frame allocator */
+    pte_t *page_table;          /* the page table of the user entry, from the frame allocator */
+    struct image_t *image;      /* cached executable, NULL if it could not be cached */
+    uint32_t inode;             /* inode of the executable, for loading pages on demand */
+    elf_t elf;                  /* segments of the executable */
+    uint32_t heap_start;        /* the heap of brk starts after the segments */
+    uint32_t heap_end;          /* the program break, end of the heap */
+    shm_map_t shm[SHM_PER_PROCESS];     /* shared memory segments attached */
+    /* the fields below are set up by the stack cache and kept across processes */
     uint32_t esp0;              /* the tss.esp0 for the process */
     uint8_t argv[128];          /* argument passed by the user */
     file_t files[8];            /* files opened by the process */
+    uint8_t fpu_state[FPU_STATE_SIZE] __attribute__((aligned(16)));  /* x87 and SSE registers saved by fxsave */
 } pcb_t;
 
 /**
@@ -56,6 +106,7 @@ typedef struct terminal_t {
         uint32_t length;
         uint32_t in_progress;           /* if user is inputing in this terminal */
         uint32_t to_be_halt;            /* if user pressed Ctrl + C */
+        wait_queue_t readers;           /* processes waiting for a line */
     } input;
     struct {
         int x;
@@ -1,119 +1,448 @@
 #include "malloc.h"
 #include "paging.h"
+#include "frame.h"
 
-#define PAGE_FRAME_SIZE 0x1000
-#define KMALLOC_BEGIN   0x3000000
-#define KMALLOC_PDE     (KMALLOC_BEGIN >> 22)
-#define KMALLOC_PDE_COUNT   4
-#define KMALLOC_SIZE    (PAGE_FRAME_SIZE * PAGING_COUNT * KMALLOC_PDE_COUNT)
+#define SLAB_ORDER      2               /* each slab of a size class is 16 KB from get_free_pages */
+#define SLAB_SIZE       (BUDDY_PAGE_SIZE << SLAB_ORDER)
+#define SLAB_MIN_SHIFT  4               /* the smallest class holds 16 bytes */
+#define SLAB_MAX_SHIFT  11              /* the largest class holds 2 KB, larger requests take pages */
+#define SLAB_CLASSES    (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+#define SLAB_MIN_OBJECTS    8           /* typed caches grow slabs until this many objects fit */
+#define SLAB_OFF_SLAB_SIZE  (BUDDY_PAGE_SIZE / 8)   /* typed caches of objects this large keep headers apart */
 
-#define ALIGNED_SIZE(x) ((x + 15) & (~15))
+#define PAGE_SLAB       0x80            /* page_tags: the page belongs to a slab of a size class */
 
-pte_t page_table_kmalloc[PAGING_COUNT * KMALLOC_PDE_COUNT] __attribute__((aligned(PAGING_ALIGN)));
+#define KMALLOC_BEGIN       0x10000000  /* above the memory identity mapped for get_free_pages */
+#define KMALLOC_PDE         (KMALLOC_BEGIN >> 22)
+#define KMALLOC_PDE_MAX     16          /* the heap spans at most 64 MB */
+#define KMALLOC_MAX_PAGES   (PAGING_COUNT * KMALLOC_PDE_MAX)
+#define KMALLOC_RAM_SHARE   4           /* the heap spans a quarter of the memory found at boot */
 
-typedef struct block_t {
-    struct block_t *prev;
-    struct block_t *next;
-    void *start;
-    uint32_t size;
-} block_t;
+#define ALIGN_UP(x, a)  (((x) + (a) - 1) / (a) * (a))
 
-block_t *kmem_blocks;
+/**
+ * @brief \c slab_t heads a slab, followed by its objects, or kept apart
+ * for large objects
+ */
+typedef struct slab_t {
+    kmem_cache_t *cache;        /* the cache the objects belong to */
+    uint8_t *mem;               /* the pages of the slab */
+    struct slab_t *next;        /* next slab of the cache with free objects */
+    struct slab_t *prev;        /* previous slab of the cache with free objects */
+    void *free;                 /* free objects, each holding the next one */
+    uint32_t in_use;            /* objects handed out */
+} slab_t;
+
+#define SLAB_LINKS(slab)    ((uint16_t *)((slab) + 1))  /* free links after the header, 1 + index of the next */
+
+static kmem_cache_t size_classes[SLAB_CLASSES];
+static uint8_t page_tags[BUDDY_PAGE_COUNT];         /* what kmalloc uses each page for, 0 if not */
+static slab_t *slab_headers[BUDDY_PAGE_COUNT];      /* off-slab header of the slab starting at each page */
+
+pte_t page_table_kmalloc[KMALLOC_MAX_PAGES] __attribute__((aligned(PAGING_ALIGN)));
+static uint16_t heap_lengths[KMALLOC_MAX_PAGES];    /* pages of the block starting at each page */
+static uint32_t heap_pages = 0;                     /* pages the heap spans, by the size of memory */
+static uint32_t heap_end = KMALLOC_BEGIN;           /* end of the heap */
+static uint32_t heap_hint = 0;                      /* no free page of the heap below */
+
+/**
+ * @brief finds the free object after \p obj in \p slab; objects of a
+ * cache with a constructor keep their links in the header, others in
+ * their first word
+ *
+ * @param slab the slab
+ * @param obj a free object of the slab
+ * @return the next free object, NULL if \p obj is the last
+ */
+static void *slab_next(slab_t *slab, void *obj) {
+    kmem_cache_t *cache = slab->cache;
+    uint16_t next;
+    if (!cache->ctor) {
+        return *(void **)obj;
+    }
+    next = SLAB_LINKS(slab)[((uint8_t *)obj - slab->mem - cache->first) / cache->size];
+    return next ? slab->mem + cache->first + (next - 1) * cache->size : NULL;
+}
+
+/**
+ * @brief pushes \p obj to the free objects of \p slab, leaving a
+ * constructed object untouched
+ *
+ * @param slab the slab
+ * @param obj the object
+ */
+static void slab_push(slab_t *slab, void *obj) {
+    kmem_cache_t *cache = slab->cache;
+    if (!cache->ctor) {
+        *(void **)obj = slab->free;
+    } else {
+        SLAB_LINKS(slab)[((uint8_t *)obj - slab->mem - cache->first) / cache->size] = slab->free
+            ? ((uint8_t *)slab->free - slab->mem - cache->first) / cache->size + 1 : 0;
+    }
+    slab->free = obj;
+}
+
+/**
+ * @brief gets a new slab for \p cache with every object free
+ *
+ * @param cache the cache
+ * @return the slab, NULL if out of memory
+ */
+static slab_t *slab_grow(kmem_cache_t *cache) {
+    uint32_t i;
+    uint8_t *obj, *mem = get_free_pages(cache->order);
+    slab_t *slab = (slab_t *)mem;
+    if (!mem) {
+        return NULL;
+    }
+    if (cache->off_slab) {
+        if (!(slab = kmalloc(cache->header))) {     /* from kmalloc, never off-slab */
+            free_pages(mem, cache->order);
+            return NULL;
+        }
+        slab_headers[(uint32_t)mem / BUDDY_PAGE_SIZE] = slab;
+    }
+    if (cache >= size_classes && cache < size_classes + SLAB_CLASSES) {
+        memset(page_tags + (uint32_t)mem / BUDDY_PAGE_SIZE, PAGE_SLAB, 1 << SLAB_ORDER);
+    }
+
+    slab->cache = cache;
+    slab->mem = mem;
+    slab->in_use = 0;
+    slab->free = NULL;
+    obj = mem + cache->first + (cache->per_slab - 1) * cache->size;
+    for (i = 0; i < cache->per_slab; ++i, obj -= cache->size) {
+        if (cache->ctor) {
+            cache->ctor(obj);                       /* constructed once, kept so across frees */
+        }
+        slab_push(slab, obj);                       /* low objects are handed out first */
+    }
+
+    slab->prev = NULL;
+    slab->next = cache->partial;
+    if (cache->partial) {
+        cache->partial->prev = slab;
+    }
+    cache->partial = slab;
+    cache->free_count += cache->per_slab;
+    ++cache->slabs;
+    return slab;
+}
+
+/**
+ * @brief takes \p slab off the slabs of its cache with free objects
+ *
+ * @param slab the slab
+ */
+static void slab_unlink(slab_t *slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        slab->cache->partial = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+/**
+ * @brief takes a free object of \p cache, growing it by a slab if none
+ * is left
+ *
+ * @param cache the cache
+ * @return the object, NULL if out of memory
+ */
+static void *slab_alloc(kmem_cache_t *cache) {
+    uint32_t flags;
+    void *obj;
+    slab_t *slab;
+
+    cli_and_save(flags);
+    if (!(slab = cache->partial) && !(slab = slab_grow(cache))) {
+        restore_flags(flags);
+        return NULL;
+    }
+    obj = slab->free;
+    slab->free = slab_next(slab, obj);
+    ++slab->in_use;
+    ++cache->in_use;
+    --cache->free_count;
+    if (!slab->free) {
+        slab_unlink(slab);                          /* full, found again by kfree */
+    }
+    restore_flags(flags);
+    return obj;
+}
+
+/**
+ * @brief puts \p obj back to its slab; an empty slab goes back to the
+ * page allocator if its cache has other free objects
+ *
+ * @param cache the cache of the object
+ * @param obj the object from \c slab_alloc
+ */
+static void slab_free(kmem_cache_t *cache, void *obj) {
+    uint32_t flags;
+    uint32_t mem = (uint32_t)obj & ~((BUDDY_PAGE_SIZE << cache->order) - 1);
+    slab_t *slab = cache->off_slab ? slab_headers[mem / BUDDY_PAGE_SIZE] : (slab_t *)mem;
+
+    cli_and_save(flags);
+    if (!slab->free) {                              /* was full, can hand out again */
+        slab->prev = NULL;
+        slab->next = cache->partial;
+        if (cache->partial) {
+            cache->partial->prev = slab;
+        }
+        cache->partial = slab;
+    }
+    slab_push(slab, obj);
+    --slab->in_use;
+    --cache->in_use;
+    ++cache->free_count;
+
+    if (!slab->in_use && cache->free_count > cache->per_slab) {
+        slab_unlink(slab);                          /* keeps one empty slab for the next burst */
+        cache->free_count -= cache->per_slab;
+        --cache->slabs;
+        memset(page_tags + mem / BUDDY_PAGE_SIZE, 0, 1 << cache->order);
+        free_pages((void *)mem, cache->order);
+        if (cache->off_slab) {
+            slab_headers[mem / BUDDY_PAGE_SIZE] = NULL;
+            kfree(slab);
+        }
+    }
+    restore_flags(flags);
+}
+
+/**
+ * @brief reserves \p count contiguous pages of the kernel heap, the
+ * first fit; frames are mapped as the pages are touched
+ *
+ * @param count number of pages
+ * @return the first page, NULL if the heap has no such room
+ */
+static void *heap_reserve(uint32_t count) {
+    uint32_t start, i;
+    for (start = heap_hint; start + count <= heap_pages; start = i + 1) {
+        for (i = start; i < start + count && !page_table_kmalloc[i].val; ++i);
+        if (i == start + count) {
+            for (i = start; i < start + count; ++i) {
+                page_table_kmalloc[i].available = PTE_RESERVED;
+            }
+            heap_lengths[start] = count;
+            if (start == heap_hint) {
+                heap_hint += count;
+            }
+            return (void *)(KMALLOC_BEGIN + start * BUDDY_PAGE_SIZE);
+        }
+    }
+    return NULL;
+}
 
+/**
+ * @brief unmaps the heap block at \p ptr and releases its frames
+ *
+ * @param ptr the first page of a block from \c heap_reserve
+ */
+static void heap_release(void *ptr) {
+    uint32_t start = ((uint32_t)ptr - KMALLOC_BEGIN) / BUDDY_PAGE_SIZE, i;
+    pte_t *pte = page_table_kmalloc + start;
+    for (i = 0; i < heap_lengths[start]; ++i, ++pte) {
+        if (pte->present) {
+            frame_put(pte->page_base_address << 12);
+            invlpg((uint8_t *)ptr + i * BUDDY_PAGE_SIZE);
+        }
+        pte->val = 0;
+    }
+    heap_lengths[start] = 0;
+    if (start < heap_hint) {
+        heap_hint = start;
+    }
+}
+
+/**
+ * @brief sets up the size classes of kmalloc, whose slabs are taken
+ * from the page allocator on first use, and the page tables of the
+ * kernel heap, which start empty; the heap is sized by the memory
+ * found at boot
+ */
 void kmalloc_init() {
-    pte_t *pos = page_table_kmalloc;
-    uint32_t i, j = 0;
-    for (i = 0; i < KMALLOC_PDE_COUNT; ++i) {
+    uint32_t i, pdes;
+    kmem_cache_t *cache;
+    memset(page_tags, 0, sizeof(page_tags));
+    memset(slab_headers, 0, sizeof(slab_headers));
+    memset(page_table_kmalloc, 0, sizeof(page_table_kmalloc));
+    memset(heap_lengths, 0, sizeof(heap_lengths));
+    heap_hint = 0;
+    pdes = (buddy_total_pages() / KMALLOC_RAM_SHARE + PAGING_COUNT - 1) / PAGING_COUNT;
+    if (!pdes) {
+        pdes = 1;
+    } else if (pdes > KMALLOC_PDE_MAX) {
+        pdes = KMALLOC_PDE_MAX;
+    }
+    heap_pages = pdes * PAGING_COUNT;
+    heap_end = KMALLOC_BEGIN + heap_pages * BUDDY_PAGE_SIZE;
+    for (i = 0; i < pdes; ++i) {                    /* shared by every page directory copied later */
+        page_directories[KMALLOC_PDE + i].val = 0;
         page_directories[KMALLOC_PDE + i].KB.present = 1;
-        page_directories[KMALLOC_PDE + i].KB.user_supervisor = 0;
         page_directories[KMALLOC_PDE + i].KB.read_write = 1;
-        page_directories[KMALLOC_PDE + i].KB.page_size = 0;
-        page_directories[KMALLOC_PDE + i].KB.page_table_base_address = ((uint32_t)(pos) >> 12);
-
-        for (j = 0; j < PAGING_COUNT; ++j, ++pos) {
-            pos->present = 1;
-            pos->user_supervisor = 0;
-            pos->read_write = 1;
-            pos->page_base_address = j;
-        }
+        page_directories[KMALLOC_PDE + i].KB.page_table_base_address =
+            (uint32_t)(page_table_kmalloc + i * PAGING_COUNT) >> 12;
     }
-    memset((void *)KMALLOC_BEGIN, 0, KMALLOC_SIZE);
-    // kmem_blocks->prev = kmem_blocks->next = NULL;
-    // kmem_blocks->start = (void *)(KMALLOC_BEGIN + sizeof(block_t));
-    // kmem_blocks->size = KMALLOC_SIZE - sizeof(block_t);
-}
-
-// static uint32_t block_size[] = {
-//     sizeof(block_t) << 0,
-//     sizeof(block_t) << 1,
-//     sizeof(block_t) << 2,
-//     sizeof(block_t) << 3,
-//     sizeof(block_t) << 4,
-//     sizeof(block_t) << 5,
-//     sizeof(block_t) << 6,
-//     sizeof(block_t) << 7,
-//     sizeof(block_t) << 8,
-//     sizeof(block_t) << 9,
-//     sizeof(block_t) << 10,
-//     sizeof(block_t) << 11,
-//     sizeof(block_t) << 12,
-//     sizeof(block_t) << 13,
-//     sizeof(block_t) << 14,
-//     sizeof(block_t) << 15,
-// };
+
+    for (i = 0, cache = size_classes; i < SLAB_CLASSES; ++i, ++cache) {
+        memset(cache, 0, sizeof(kmem_cache_t));
+        cache->name = (const int8_t *)"kmalloc";
+        cache->size = 1 << (SLAB_MIN_SHIFT + i);
+        cache->order = SLAB_ORDER;
+        cache->header = sizeof(slab_t);
+        cache->first = ALIGN_UP(cache->header, cache->size);    /* objects are aligned to their size */
+        cache->per_slab = (SLAB_SIZE - cache->first) / cache->size;
+    }
+}
 
 /**
  * @brief allocates a block of memory in \p size for kernel-level
- * program
- * 
+ * program; small blocks come from the slab of their size class, larger
+ * ones are pages of the kernel heap, backed by zeroed frames as they
+ * are first touched
+ *
  * @param size size of memory in bytes
- * @return starting address of memory
+ * @return starting address of memory, aligned to the smaller of its
+ * size class and a page; NULL if \p size is 0 or out of memory
  */
 void *kmalloc(uint32_t size) {
-    if (!size || size > 0x400000) {             /* kmalloc is for small block of data */
+    uint32_t flags, shift;
+    void *block;
+    if (!size || size > (BUDDY_PAGE_SIZE << BUDDY_MAX_ORDER)) {
         return NULL;
     }
-    
-    size = ALIGNED_SIZE(size);
-    uint32_t real_size = size + sizeof(block_t);
-    block_t *curr;
-    for (curr = kmem_blocks; curr; curr = curr->next) {
-        if (curr->size >= size) {
-            if (curr->size - size < sizeof(block_t)) {
-                if (curr->prev) {               /* remove this block from free blocks */
-                    curr->prev->next = curr->next;
-                }
-                if (curr->next) {
-                    curr->next->prev = curr->prev;
-                }
-                return (void *)(curr + 1);      /* all spaces is now used up */
-            }
 
-            curr->size = size;
-            block_t *next = (block_t *)((unsigned char *)curr + real_size);
-            next->size = curr->size - real_size;
-            next->prev = curr->prev;
-            next->next = curr->next;
-            if (curr->prev) {
-                curr->prev->next = next;
-            }
-            if (curr->next) {
-                curr->next->prev = next;
-            }
-            if (curr == kmem_blocks) {
-                kmem_blocks = next;
-            }
-            return (void *)(curr + 1);
+    if (size <= (1 << SLAB_MAX_SHIFT)) {
+        for (shift = SLAB_MIN_SHIFT; (1U << shift) < size; ++shift);
+        return slab_alloc(size_classes + shift - SLAB_MIN_SHIFT);
+    }
+
+    cli_and_save(flags);
+    block = heap_reserve((size + BUDDY_PAGE_SIZE - 1) / BUDDY_PAGE_SIZE);
+    restore_flags(flags);
+    return block;
+}
+
+/**
+ * @brief releases the block at \p ptr from \c kmalloc
+ *
+ * @param ptr the block, nullable
+ */
+void kfree(void *ptr) {
+    uint32_t flags, pfn = (uint32_t)ptr / BUDDY_PAGE_SIZE;
+    if ((uint32_t)ptr >= KMALLOC_BEGIN && (uint32_t)ptr < heap_end) {
+        cli_and_save(flags);
+        heap_release(ptr);
+        restore_flags(flags);
+    } else if (ptr && pfn < BUDDY_PAGE_COUNT && (page_tags[pfn] & PAGE_SLAB)) {
+        slab_free(((slab_t *)((uint32_t)ptr & ~(SLAB_SIZE - 1)))->cache, ptr);
+    }
+}
+
+/**
+ * @brief maps a zeroed frame to the kernel heap page at \p addr, called
+ * on a page fault of the kernel
+ *
+ * @param addr the faulting linear address
+ * @return 0 if the page is mapped, -1 if it is not part of a block or
+ * out of memory
+ */
+int32_t kmalloc_fault(uint32_t addr) {
+    uint32_t frame;
+    pte_t *pte = page_table_kmalloc + (addr - KMALLOC_BEGIN) / BUDDY_PAGE_SIZE;
+    if (addr < KMALLOC_BEGIN || addr >= heap_end
+        || pte->present || !(pte->available & PTE_RESERVED)
+        || !(frame = frame_alloc_zeroed())) {
+        return -1;
+    }
+    pte->page_base_address = frame >> 12;
+    pte->read_write = 1;
+    pte->global = 1;
+    pte->present = 1;
+    return 0;
+}
+
+/**
+ * @brief sets the header, first object and objects per slab of
+ * \p cache for its current order
+ *
+ * @param cache the cache with size, ctor and off_slab set
+ * @param align the alignment of each object
+ * @return offset of the first object in a slab
+ */
+static uint32_t slab_layout(kmem_cache_t *cache, uint32_t align) {
+    uint32_t bytes = BUDDY_PAGE_SIZE << cache->order, links = 0;
+    if (cache->ctor) {                              /* a free link for each object, none fit more */
+        links = (bytes - (cache->off_slab ? 0 : sizeof(slab_t))) / cache->size;
+    }
+    cache->header = sizeof(slab_t) + links * sizeof(uint16_t);
+    cache->first = cache->off_slab ? 0 : ALIGN_UP(cache->header, align);
+    cache->per_slab = bytes > cache->first ? (bytes - cache->first) / cache->size : 0;
+    return cache->first;
+}
+
+/**
+ * @brief creates a cache of objects of one type; objects are aligned
+ * to at least a cache line and kept constructed while free
+ *
+ * @param name the name of the cache, for debugging
+ * @param size bytes of each object
+ * @param align the alignment of each object, a power of two, 0 for a
+ * cache line
+ * @param ctor run on every object as its slab is created, nullable;
+ * objects must be freed in the constructed state
+ * @return the cache, NULL if out of memory or \p size is too large
+ */
+kmem_cache_t *kmem_cache_create(const int8_t *name, uint32_t size, uint32_t align, void (*ctor)(void *)) {
+    kmem_cache_t *cache;
+    if (align < CACHE_LINE_SIZE) {
+        align = CACHE_LINE_SIZE;
+    }
+    if (!size || !(cache = kmalloc(sizeof(kmem_cache_t)))) {
+        return NULL;
+    }
+
+    memset(cache, 0, sizeof(kmem_cache_t));
+    cache->name = name;
+    cache->size = ALIGN_UP(size, align);            /* keeps every object on its own lines */
+    cache->off_slab = cache->size >= SLAB_OFF_SLAB_SIZE;   /* a header would waste a whole object */
+    cache->ctor = ctor;
+    for (cache->order = 0; cache->order < BUDDY_MAX_ORDER; ++cache->order) {
+        if ((BUDDY_PAGE_SIZE << cache->order) >= slab_layout(cache, align) + SLAB_MIN_OBJECTS * cache->size) {
+            break;
         }
     }
+    if ((BUDDY_PAGE_SIZE << cache->order) < slab_layout(cache, align) + cache->size) {
+        kfree(cache);                               /* not a single object fits */
+        return NULL;
+    }
+    return cache;
+}
 
-    kmem_blocks = (block_t *)(KMALLOC_BEGIN);  /* no alloc happens */
-    kmem_blocks->size = size;                  /* the remaining size */
-    kmem_blocks->prev = NULL;                  /* the first one */
-    kmem_blocks->next = NULL;
-    kmem_blocks = (block_t *)((unsigned char*)kmem_blocks + real_size);
-    kmem_blocks->size = (KMALLOC_SIZE - real_size);
-    kmem_blocks->prev = NULL;
-    kmem_blocks->next = NULL;
-    return (void *)(KMALLOC_BEGIN + sizeof(block_t));
+/**
+ * @brief takes an object from \p cache
+ *
+ * @param cache the cache from \c kmem_cache_create
+ * @return the object in its constructed state, NULL if out of memory
+ */
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    return slab_alloc(cache);
+}
+
+/**
+ * @brief returns \p obj to \p cache
+ *
+ * @param cache the cache the object was taken from
+ * @param obj the object in its constructed state, nullable
+ */
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    if (obj) {
+        slab_free(cache, obj);
+    }
 }
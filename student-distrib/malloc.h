@@ -2,46 +2,95 @@
 #define _MALLOC_H
 
 #include "lib.h"
+#include "buddy.h"
+
+#define CACHE_LINE_SIZE     64          /* the smallest alignment of typed cache objects */
 
 /**
- * @brief allocates a block of runtime memory with size \p size
- * 
- * @param size size of memory in byte
- * @return allocated memory
+ * @brief \c kmem_cache_t hands out objects of one size from slabs of
+ * contiguous pages, which start with their own header unless the
+ * objects are large
  */
-extern void *malloc(uint32_t size);
+typedef struct kmem_cache_t {
+    const int8_t *name;         /* what the cache holds */
+    uint32_t size;              /* bytes between two objects */
+    uint32_t order;             /* each slab is 2^order pages */
+    uint32_t first;             /* offset of the first object in a slab */
+    uint32_t off_slab;          /* slab headers are kmalloc blocks, not the start of the slab */
+    uint32_t header;            /* bytes of a slab header, with free links if objects are constructed */
+    uint32_t per_slab;          /* objects in a slab */
+    uint32_t in_use;            /* objects handed out */
+    uint32_t free_count;        /* free objects in all slabs */
+    uint32_t slabs;             /* slabs taken from the page allocator */
+    void (*ctor)(void *);       /* prepares an object as its slab is created, nullable */
+    struct slab_t *partial;     /* slabs with free objects */
+} kmem_cache_t;
 
 /**
- * @brief enlarges the allocated memory starting at \p src with new
- * size \p size
- * 
- * @param src starting address of memory
- * @param size new size of memory in byte
- * @return allocated memory
+ * @brief sets up the size classes of kmalloc, whose slabs are taken
+ * from the page allocator on first use, and the page tables of the
+ * kernel heap, which start empty; the heap is sized by the memory
+ * found at boot
  */
-extern void *realloc(void *src, uint32_t size);
+extern void kmalloc_init();
 
 /**
- * @brief releases the ownership of the memory starting at \p src
- * 
- * @param src starting address of memory
+ * @brief allocates a block of memory in \p size for kernel-level
+ * program; small blocks come from the slab of their size class, larger
+ * ones are pages of the kernel heap, backed by zeroed frames as they
+ * are first touched
+ *
+ * @param size size of memory in bytes
+ * @return starting address of memory, aligned to the smaller of its
+ * size class and a page; NULL if \p size is 0 or out of memory
  */
-extern void free(void *src);
+extern void *kmalloc(uint32_t size);
 
 /**
- * @brief initializes memory and page table entries for kmalloc
+ * @brief releases the block at \p ptr from \c kmalloc
+ *
+ * @param ptr the block, nullable
  */
-extern void kmalloc_init();
+extern void kfree(void *ptr);
 
 /**
- * @brief allocates a block of memory in \p size for kernel-level
- * program
- * 
- * @param size size of memory in bytes
- * @return starting address of memory
+ * @brief maps a zeroed frame to the kernel heap page at \p addr, called
+ * on a page fault of the kernel
+ *
+ * @param addr the faulting linear address
+ * @return 0 if the page is mapped, -1 if it is not part of a block or
+ * out of memory
  */
-extern void *kmalloc(uint32_t size);
+extern int32_t kmalloc_fault(uint32_t addr);
 
-extern void *get_free_pages(uint32_t order);
+/**
+ * @brief creates a cache of objects of one type; objects are aligned
+ * to at least a cache line and kept constructed while free
+ *
+ * @param name the name of the cache, for debugging
+ * @param size bytes of each object
+ * @param align the alignment of each object, a power of two, 0 for a
+ * cache line
+ * @param ctor run on every object as its slab is created, nullable;
+ * objects must be freed in the constructed state
+ * @return the cache, NULL if out of memory or \p size is too large
+ */
+extern kmem_cache_t *kmem_cache_create(const int8_t *name, uint32_t size, uint32_t align, void (*ctor)(void *));
+
+/**
+ * @brief takes an object from \p cache
+ *
+ * @param cache the cache from \c kmem_cache_create
+ * @return the object in its constructed state, NULL if out of memory
+ */
+extern void *kmem_cache_alloc(kmem_cache_t *cache);
+
+/**
+ * @brief returns \p obj to \p cache
+ *
+ * @param cache the cache the object was taken from
+ * @param obj the object in its constructed state, nullable
+ */
+extern void kmem_cache_free(kmem_cache_t *cache, void *obj);
 
 #endif
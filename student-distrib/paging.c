@@ -1,8 +1,17 @@
 #include "paging.h"
 #include "syscall.h"
+#include "image.h"
+#include "frame.h"
+#include "buddy.h"
+#include "malloc.h"
+#include "swap.h"
+#include "debug.h"
 
+#define USER_ENTRY_END          ((USER_ENTRY + 1) << 22)   /* end of the user page table */
 #define PAGING_FLAG  0x80000001 /* first: paging enable; last: protection mode*/
+#define PAGING_WRITE_PROTECT_FLAG  0x00010000 /* read-only pages are read-only for the kernel too */
 #define PAGING_SIZE_EXTENTION_FLAG 0x00000010 /* enables 4MB pages */
+#define PAGING_GLOBAL_FLAG         0x00000080 /* global pages survive loads of CR3 */
 
 void paging_init() {
     memset(page_directories, 0, sizeof(page_directories));
@@ -11,18 +20,30 @@ void paging_init() {
 
     int i;
     page_directories[0].KB.present = 1;
+    page_directories[0].KB.read_write = 1;      /* kernel writes obey read_write as WP is set */
     page_directories[0].val |= (uint32_t)page_table_kernel_vidmem;
     page_directories[1].MB.present = 1;
+    page_directories[1].MB.read_write = 1;
     page_directories[1].MB.page_size = 1;
+    page_directories[1].MB.global = 1;          /* the same in every page directory */
     page_directories[1].val |= KERNEL_ADDR;
     page_table_kernel_vidmem[1].page_base_address = 1;
+    page_table_kernel_vidmem[1].read_write = 1;
+    page_table_kernel_vidmem[1].global = 1;
     page_table_user_vidmem[1].page_base_address = 1;
     for (i = 2; i < PAGING_COUNT; ++i) {
         page_directories[i].MB.page_size = 1;
         page_directories[i].MB.page_base_address = i;
         page_table_kernel_vidmem[i].page_base_address = i;
+        page_table_kernel_vidmem[i].read_write = 1;
+        page_table_kernel_vidmem[i].global = 1;
         page_table_user_vidmem[i].page_base_address = i;
     }
+    for (i = BUDDY_START >> 22; i < buddy_end() >> 22; ++i) {
+        page_directories[i].MB.present = 1;     /* identity mapped, blocks of get_free_pages are used in place */
+        page_directories[i].MB.read_write = 1;
+        page_directories[i].MB.global = 1;
+    }
     page_table_kernel_vidmem[VIDMEM_INDEX].present = 1;
     page_table_user_vidmem[VIDMEM_INDEX].present = 0;
     page_table_user_vidmem[VIDMEM_INDEX].user_supervisor = 1;
@@ -43,7 +64,403 @@ void paging_init() {
         "orl  %2, %%edx\n"
         "movl %%edx, %%cr0\n"
         :
-        :"r"(page_directories), "r"(PAGING_SIZE_EXTENTION_FLAG), "r"(PAGING_FLAG)
+        :"r"(page_directories), "r"(PAGING_SIZE_EXTENTION_FLAG | PAGING_GLOBAL_FLAG), "r"(PAGING_FLAG | PAGING_WRITE_PROTECT_FLAG)
         :"%edx"
     );
 }
+
+/**
+ * @brief gives \p pcb its own page directory, sharing every kernel
+ * mapping, with an empty page table for its user entry; both are taken
+ * from the frame allocator
+ *
+ * @param pcb the process
+ * @return 0 if success, -1 if out of memory
+ */
+int32_t paging_new_user(pcb_t *pcb) {
+    uint32_t directory = frame_alloc(), table = frame_alloc_zeroed();
+    if (!directory || !table) {
+        if (directory) {
+            frame_put(directory);
+        }
+        if (table) {
+            frame_put(table);
+        }
+        pcb->page_directory = NULL;
+        pcb->page_table = NULL;
+        return -1;
+    }
+
+    pcb->page_table = (pte_t *)table;               /* the pool is identity mapped, all entries empty */
+    pcb->page_directory = (pde_t *)directory;
+    memcpy(pcb->page_directory, page_directories, PAGING_ALIGN);
+
+    pde_t *pde = pcb->page_directory + USER_ENTRY;
+    pde->val = 0;
+    pde->KB.present = 1;
+    pde->KB.user_supervisor = 1;                    /* user can access the page */
+    pde->KB.read_write = 1;                         /* user can write the page */
+    pde->KB.page_size = 0;
+    pde->KB.page_table_base_address = table >> 12;
+    return 0;
+}
+
+/**
+ * @brief releases what the user page at \p pte holds: its frame, or
+ * its slot on the swap drive
+ *
+ * @param pte the page table entry
+ */
+static void paging_release(pte_t *pte) {
+    if (pte->present) {
+        if (!(pte->available & PTE_IMAGE)) {
+            frame_put(pte->page_base_address << 12);
+        }
+    } else if (pte->available & PTE_SWAPPED) {
+        swap_put(pte->page_base_address);
+    }
+}
+
+/**
+ * @brief unmaps every page of the user entry of \p pcb, so that they
+ * are loaded on the first touch; frames are released as their last
+ * sharer lets them go
+ *
+ * @param pcb the process
+ */
+void paging_clear_user(pcb_t *pcb) {
+    uint32_t i;
+    pte_t *pte = pcb->page_table;
+    for (i = 0; i < PAGING_COUNT; ++i, ++pte) {
+        paging_release(pte);
+        pte->val = 0;
+    }
+}
+
+/**
+ * @brief unmaps every page of the user entry of \p pcb and releases
+ * its page table and page directory
+ *
+ * @param pcb the process
+ */
+void paging_free_user(pcb_t *pcb) {
+    uint32_t cr3;
+    if (!pcb->page_table) {
+        return;
+    }
+    paging_clear_user(pcb);
+
+    asm volatile ("movl %%cr3, %0" : "=r"(cr3));
+    if (cr3 == (uint32_t)pcb->page_directory) {     /* never runs on a released directory */
+        asm volatile ("movl %0, %%cr3" : : "r"(page_directories) : "memory");
+    }
+    frame_put((uint32_t)pcb->page_table);
+    frame_put((uint32_t)pcb->page_directory);
+    pcb->page_table = NULL;
+    pcb->page_directory = NULL;
+}
+
+/**
+ * @brief finds the entry of \p start in the user page table of \p pcb,
+ * checking that [\p start, \p end) lies within the user entry
+ *
+ * @param pcb the process
+ * @param start the first page, aligned
+ * @param end the end of the last page, aligned
+ * @return the entry of \p start, NULL if the range leaves the user entry
+ */
+static pte_t *paging_user_pte(pcb_t *pcb, uint32_t start, uint32_t end) {
+    ASSERT((start >> 22) == USER_ENTRY && start <= end && end <= USER_ENTRY_END);
+    if ((start >> 22) != USER_ENTRY || start > end || end > USER_ENTRY_END) {
+        return NULL;                                /* never wraps to another page of the table */
+    }
+    return pcb->page_table + ((start >> 12) & (PAGING_COUNT - 1));
+}
+
+/**
+ * @brief reserves the user pages of \p pcb in [\p start, \p end), which
+ * are mapped zeroed on the first touch
+ *
+ * @param pcb the process
+ * @param start the first page, aligned
+ * @param end the end of the last page, aligned
+ */
+void paging_reserve_user(pcb_t *pcb, uint32_t start, uint32_t end) {
+    pte_t *pte = paging_user_pte(pcb, start, end);
+    if (!pte) {
+        return;
+    }
+    for (; start < end; start += PAGING_ALIGN, ++pte) {
+        pte->available |= PTE_RESERVED;             /* not present, nothing to flush */
+    }
+}
+
+/**
+ * @brief maps the \p count frames at \p frames to the user pages of
+ * \p pcb from \p start, writable by every process sharing them
+ *
+ * @param pcb the process
+ * @param start the first page, aligned and unused
+ * @param frames physical addresses of the frames, each takes one more reference
+ * @param count number of pages
+ */
+void paging_share_user(pcb_t *pcb, uint32_t start, const uint32_t *frames, uint32_t count) {
+    pte_t *pte = count > PAGING_COUNT ? NULL : paging_user_pte(pcb, start, start + count * PAGING_ALIGN);
+    if (!pte) {
+        return;
+    }
+    for (; count; --count, ++frames, ++pte) {
+        frame_hold(*frames);
+        pte->val = 0;
+        pte->page_base_address = *frames >> 12;
+        pte->user_supervisor = 1;
+        pte->read_write = 1;
+        pte->available = PTE_SHARED;            /* stays shared across fork */
+        pte->present = 1;                       /* was not present, nothing to flush */
+    }
+}
+
+/**
+ * @brief unmaps and unreserves the user pages of \p pcb in [\p start,
+ * \p end); frames are released as their last sharer lets them go
+ *
+ * @param pcb the process
+ * @param start the first page, aligned
+ * @param end the end of the last page, aligned
+ */
+void paging_unmap_user(pcb_t *pcb, uint32_t start, uint32_t end) {
+    pte_t *pte = paging_user_pte(pcb, start, end);
+    if (!pte) {
+        return;
+    }
+    for (; start < end; start += PAGING_ALIGN, ++pte) {
+        if (pte->present) {
+            invlpg(start);                          /* the process is the current one */
+        }
+        paging_release(pte);
+        pte->val = 0;
+    }
+}
+
+/**
+ * @brief checks if no user page of \p pcb in [\p start, \p end) is
+ * mapped or reserved
+ *
+ * @param pcb the process
+ * @param start the first page, aligned
+ * @param end the end of the last page, aligned
+ * @return 1 if all of them are unused, 0 if not
+ */
+int32_t paging_unused_user(pcb_t *pcb, uint32_t start, uint32_t end) {
+    pte_t *pte = paging_user_pte(pcb, start, end);
+    if (!pte) {
+        return 0;
+    }
+    for (; start < end; start += PAGING_ALIGN, ++pte) {
+        if (pte->val) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief finds \p length bytes of unused user pages of \p pcb between
+ * its heap and its stack, the highest that fit
+ *
+ * @param pcb the process
+ * @param length the size, aligned to pages
+ * @return the first page, 0 if there is no room
+ */
+uint32_t paging_find_user(pcb_t *pcb, uint32_t length) {
+    uint32_t end, bottom = (pcb->heap_end + PAGING_ALIGN - 1) & ~(PAGING_ALIGN - 1);
+    uint32_t start = (pcb->heap_start + PAGING_ALIGN - 1) & ~(PAGING_ALIGN - 1);
+    if (bottom < start) {
+        bottom = start;                             /* never over the program, mapped or not */
+    }
+    if (bottom < USER_ENTRY << 22) {
+        bottom = USER_ENTRY << 22;                  /* never outside the user page table */
+    }
+    if (!length || bottom > USER_HEAP_LIMIT || length > USER_HEAP_LIMIT - bottom) {
+        return 0;
+    }
+    for (end = USER_HEAP_LIMIT; end >= bottom + length; end -= PAGING_ALIGN) {
+        if (paging_unused_user(pcb, end - length, end)) {
+            return end - length;                    /* top down, the heap grows up to meet it */
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief shares every user page of \p parent with \p child, writable
+ * pages but shared memory become copy-on-write in both
+ *
+ * @param parent the forking process
+ * @param child the new process, with an empty page table
+ */
+void paging_fork(pcb_t *parent, pcb_t *child) {
+    uint32_t i;
+    pte_t *pte = parent->page_table;
+    for (i = 0; i < PAGING_COUNT; ++i, ++pte) {
+        if (pte->present && !(pte->available & PTE_IMAGE)) {
+            if (pte->read_write && !(pte->available & PTE_SHARED)) {
+                pte->read_write = 0;                /* the first write copies the page */
+                pte->available |= PTE_COW;
+            }
+            frame_hold(pte->page_base_address << 12);
+        } else if (!pte->present && (pte->available & PTE_SWAPPED)) {
+            swap_hold(pte->page_base_address);      /* read back by each on its own */
+        }
+        child->page_table[i] = *pte;                /* shared text is simply shared */
+    }
+}
+
+/**
+ * @brief switches to the address space of \p pcb by loading its page
+ * directory to CR3; global kernel pages stay in the TLB
+ *
+ * @param pcb the process
+ */
+void paging_set_user(pcb_t *pcb) {
+    asm volatile ("movl %0, %%cr3" : : "r"(pcb->page_directory) : "memory");
+}
+
+/**
+ * @brief maps the video memory of the kernel and of vidmap to the
+ * screen if \p term_id is shown, or to its backing page if not
+ *
+ * @param term_id the terminal of the running process
+ */
+void paging_set_vidmem(uint32_t term_id) {
+    uint32_t base = term_id == shown_term_id ? VIDMEM_INDEX : VIDMEM_INDEX + term_id + 2;
+    page_table_kernel_vidmem[VIDMEM_INDEX].page_base_address = base;
+    page_table_user_vidmem[VIDMEM_INDEX].page_base_address = base;
+    invlpg(KERNEL_VIDMEM_ADDR);                     /* global, a load of CR3 keeps it */
+    invlpg(USER_VIDMEM_ADDR);
+}
+
+/**
+ * @brief checks if the page at \p page of \p image can be mapped from
+ * the cache, which holds when it belongs to \p seg alone, read-only,
+ * and the cached file has the page exactly as the program sees it
+ *
+ * @param image the cached image of the program
+ * @param seg the only segment on the page
+ * @param page the page-aligned user address
+ * @return 1 if the cached page can be shared, 0 if not
+ */
+static int32_t paging_shareable(image_t *image, elf_segment_t *seg, uint32_t page) {
+    uint32_t pos = seg->offset - (seg->start - page);   /* file position of the page */
+    if (seg->writable || seg->offset < seg->start - page || (pos & (PAGING_ALIGN - 1))) {
+        return 0;
+    }
+    return page + PAGING_ALIGN <= seg->file_end     /* no bss on the page */
+        || seg->end == seg->file_end
+        || (seg->offset + (seg->file_end - seg->start) == image->size   /* the cache ends with zeros */
+            && page < seg->file_end);              /* the last page of the file, later bss pages are new */
+}
+
+/**
+ * @brief maps the faulting page at \p addr of the current process:
+ * pages of read-only segments are shared from the cached image where
+ * possible, other pages of segments get a new frame filled from the
+ * file with bss zeroed, stack and reserved heap pages start zeroed,
+ * and swapped pages are read back; faults of the kernel in its heap
+ * are handed to
+ * \c kmalloc_fault
+ *
+ * @param addr the faulting linear address (CR2)
+ * @param error_code the error code pushed by the processor
+ * @return 0 if the page is mapped, -1 if the fault is fatal
+ */
+int32_t paging_fault(uint32_t addr, uint32_t error_code) {
+    if ((addr >> 22) != USER_ENTRY) {
+        return error_code & PF_USER ? -1 : kmalloc_fault(addr);    /* the kernel heap is mapped lazily */
+    }
+
+    pcb_t *curr = get_current_pcb();
+    uint32_t index = (addr >> 12) & (PAGING_COUNT - 1);
+    uint32_t page = addr & ~(PAGING_ALIGN - 1), from, to;
+    uint32_t frame, old, i, count = 0, writable = 0;
+    image_t *image = curr->image;
+    elf_segment_t *seg, *only = NULL;
+    pte_t *pte = curr->page_table + index;
+
+    if (error_code & PF_PRESENT) {                  /* protection violation */
+        if (!(error_code & PF_WRITE) || !(pte->available & PTE_COW)) {
+            return -1;
+        }
+        old = pte->page_base_address << 12;
+        if (frame_refs(old) > 1) {                  /* still shared: takes a private copy */
+            if (!(frame = frame_alloc())) {
+                return -1;
+            }
+            memcpy((void *)frame, (const void *)old, PAGING_ALIGN);
+            pte->page_base_address = frame >> 12;
+            frame_put(old);
+        }
+        pte->read_write = 1;
+        pte->available &= ~PTE_COW;
+        invlpg(page);
+        return 0;
+    }
+
+    if (pte->available & PTE_SWAPPED) {
+        return swap_in(pte);                        /* the page was reclaimed */
+    }
+
+    if (pte->available & PTE_RESERVED) {           /* heap pages start zeroed */
+        if (!(frame = frame_alloc_zeroed())) {
+            return -1;
+        }
+        pte->page_base_address = frame >> 12;
+        pte->user_supervisor = 1;
+        pte->read_write = 1;
+        pte->available = 0;
+        pte->present = 1;
+        return 0;
+    }
+
+    for (i = 0, seg = curr->elf.segments; i < curr->elf.count; ++i, ++seg) {
+        if (seg->start < page + PAGING_ALIGN && seg->end > page) {
+            only = seg;                             /* segments on this page */
+            writable |= seg->writable;
+            ++count;
+        }
+    }
+    if (!count && (page < USER_STACK - USER_STACK_SIZE || page >= USER_STACK)) {
+        return -1;                                  /* neither program nor stack */
+    }
+
+    if (image && count == 1 && paging_shareable(image, only, page)) {
+        pte->present = 1;                           /* code is shared by all instances */
+        pte->user_supervisor = 1;
+        pte->read_write = 0;
+        pte->available = PTE_IMAGE;
+        pte->page_base_address = ((uint32_t)image->data + only->offset - (only->start - page)) >> 12;
+        return 0;
+    }
+
+    if (!(frame = frame_alloc_zeroed())) {
+        return -1;                                  /* out of memory */
+    }
+    pte->present = 1;                               /* bss and stack start zeroed */
+    pte->user_supervisor = 1;
+    pte->read_write = 1;                            /* filled first, protected after */
+    pte->available = 0;
+    pte->page_base_address = frame >> 12;
+
+    for (i = 0, seg = curr->elf.segments; i < curr->elf.count; ++i, ++seg) {
+        from = seg->start > page ? seg->start : page;
+        to = seg->file_end < page + PAGING_ALIGN ? seg->file_end : page + PAGING_ALIGN;
+        if (from < to) {
+            image_read(image, curr->inode, seg->offset + (from - seg->start), (uint8_t *)from, to - from);
+        }
+    }
+    if (count && !writable) {
+        pte->read_write = 0;
+        invlpg(page);
+    }
+    return 0;
+}
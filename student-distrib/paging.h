@@ -11,10 +11,152 @@
 #define KERNEL_ADDR  0x400000
 #define KERNEL_INDEX (KERNEL_ADDR >> 12)
 
+#define KERNEL_VIDMEM_ADDR  (VIDMEM_INDEX << 12)                          /* video memory the kernel prints to */
+#define USER_VIDMEM_ADDR    ((VIDMEM_INDEX << 22) | (VIDMEM_INDEX << 12)) /* video memory given by vidmap */
+
+#define PF_PRESENT   0x1            /* page fault error code: protection violation */
+#define PF_WRITE     0x2            /* page fault error code: caused by a write */
+#define PF_USER      0x4            /* page fault error code: caused in user mode */
+
+#define PTE_COW      0x1            /* available bits: read-only until written, then copied */
+#define PTE_IMAGE    0x2            /* available bits: maps the image cache, not an allocated frame */
+#define PTE_RESERVED 0x4            /* available bits: a heap page, mapped zeroed on the first touch */
+#define PTE_SHARED   PTE_RESERVED   /* available bits of a present page: shared memory, never copy-on-write */
+#define PTE_SWAPPED  PTE_IMAGE      /* available bits of a non-present page: on the swap drive, at the slot in the address */
+
+/* drops the TLB entry of the page at \p addr */
+#define invlpg(addr)                    \
+do {                                    \
+    asm volatile ("invlpg (%0)"         \
+            :                           \
+            : "r"(addr)                 \
+            : "memory"                  \
+    );                                  \
+} while (0)
+
 pde_t page_directories[PAGING_COUNT] __attribute__((aligned(PAGING_ALIGN)));
 pte_t page_table_kernel_vidmem[PAGING_COUNT] __attribute__((aligned(PAGING_ALIGN)));
 pte_t page_table_user_vidmem[PAGING_COUNT] __attribute__((aligned(PAGING_ALIGN)));
 
 void paging_init();
 
+/**
+ * @brief gives \p pcb its own page directory, sharing every kernel
+ * mapping, with an empty page table for its user entry; both are taken
+ * from the frame allocator
+ *
+ * @param pcb the process
+ * @return 0 if success, -1 if out of memory
+ */
+int32_t paging_new_user(pcb_t *pcb);
+
+/**
+ * @brief unmaps every page of the user entry of \p pcb, so that they
+ * are loaded on the first touch; frames are released as their last
+ * sharer lets them go
+ *
+ * @param pcb the process
+ */
+void paging_clear_user(pcb_t *pcb);
+
+/**
+ * @brief unmaps every page of the user entry of \p pcb and releases
+ * its page table and page directory
+ *
+ * @param pcb the process
+ */
+void paging_free_user(pcb_t *pcb);
+
+/**
+ * @brief reserves the user pages of \p pcb in [\p start, \p end), which
+ * are mapped zeroed on the first touch
+ *
+ * @param pcb the process
+ * @param start the first page, aligned
+ * @param end the end of the last page, aligned
+ */
+void paging_reserve_user(pcb_t *pcb, uint32_t start, uint32_t end);
+
+/**
+ * @brief maps the \p count frames at \p frames to the user pages of
+ * \p pcb from \p start, writable by every process sharing them
+ *
+ * @param pcb the process
+ * @param start the first page, aligned and unused
+ * @param frames physical addresses of the frames, each takes one more reference
+ * @param count number of pages
+ */
+void paging_share_user(pcb_t *pcb, uint32_t start, const uint32_t *frames, uint32_t count);
+
+/**
+ * @brief unmaps and unreserves the user pages of \p pcb in [\p start,
+ * \p end); frames are released as their last sharer lets them go
+ *
+ * @param pcb the process
+ * @param start the first page, aligned
+ * @param end the end of the last page, aligned
+ */
+void paging_unmap_user(pcb_t *pcb, uint32_t start, uint32_t end);
+
+/**
+ * @brief checks if no user page of \p pcb in [\p start, \p end) is
+ * mapped or reserved
+ *
+ * @param pcb the process
+ * @param start the first page, aligned
+ * @param end the end of the last page, aligned
+ * @return 1 if all of them are unused, 0 if not
+ */
+int32_t paging_unused_user(pcb_t *pcb, uint32_t start, uint32_t end);
+
+/**
+ * @brief finds \p length bytes of unused user pages of \p pcb between
+ * its heap and its stack, the highest that fit
+ *
+ * @param pcb the process
+ * @param length the size, aligned to pages
+ * @return the first page, 0 if there is no room
+ */
+uint32_t paging_find_user(pcb_t *pcb, uint32_t length);
+
+/**
+ * @brief shares every user page of \p parent with \p child, writable
+ * pages but shared memory become copy-on-write in both
+ *
+ * @param parent the forking process
+ * @param child the new process, with an empty page table
+ */
+void paging_fork(pcb_t *parent, pcb_t *child);
+
+/**
+ * @brief switches to the address space of \p pcb by loading its page
+ * directory to CR3; global kernel pages stay in the TLB
+ *
+ * @param pcb the process
+ */
+void paging_set_user(pcb_t *pcb);
+
+/**
+ * @brief maps the video memory of the kernel and of vidmap to the
+ * screen if \p term_id is shown, or to its backing page if not
+ *
+ * @param term_id the terminal of the running process
+ */
+void paging_set_vidmem(uint32_t term_id);
+
+/**
+ * @brief maps the faulting page at \p addr of the current process:
+ * pages of read-only segments are shared from the cached image where
+ * possible, other pages of segments get a new frame filled from the
+ * file with bss zeroed, stack and reserved heap pages start zeroed,
+ * and swapped pages are read back; faults of the kernel in its heap
+ * are handed to
+ * \c kmalloc_fault
+ *
+ * @param addr the faulting linear address (CR2)
+ * @param error_code the error code pushed by the processor
+ * @return 0 if the page is mapped, -1 if the fault is fatal
+ */
+int32_t paging_fault(uint32_t addr, uint32_t error_code);
+
 #endif
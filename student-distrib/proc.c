@@ -0,0 +1,231 @@
+#include "proc.h"
+#include "malloc.h"
+#include "swap.h"
+
+#define PID_BITS                32                  /* pids per word of the bitmap */
+
+pcb_t *proc_list = NULL;
+
+static pcb_t *proc_table[MAX_PROCESS];              /* indexed by pid */
+static uint32_t pid_bitmap[MAX_PROCESS / PID_BITS]; /* set bits are pids in use */
+static uint32_t pid_hint = 0;                       /* no free pid in the words below */
+static uint32_t proc_count = 0;                     /* live processes */
+static uint32_t proc_max = MAX_PROCESS;             /* live processes the memory can hold */
+static kmem_cache_t *stack_cache = NULL;            /* kernel stacks, each with its pcb at the bottom */
+static pcb_t *stack_to_free = NULL;                 /* freed while running on it, released later */
+
+#define PCB_RESET_SIZE          ((uint32_t)&((pcb_t *)0)->esp0)    /* state of one process, cleared per process */
+
+/**
+ * @brief constructs the pcb at the bottom of the kernel stack \p obj,
+ * as its slab is created; esp0 stays fixed and the other fields after
+ * it are left cleared by the processes that used them
+ *
+ * @param obj the kernel stack
+ */
+static void proc_stack_ctor(void *obj) {
+    pcb_t *pcb = (pcb_t *)obj;
+    memset(pcb, 0, sizeof(pcb_t));
+    pcb->esp0 = (uint32_t)pcb + KERNEL_STACK_SIZE;
+}
+
+/**
+ * @brief releases the stack left by a process that freed itself, unless
+ * it is still the one executing
+ */
+static void proc_release_stack() {
+    if (stack_to_free && stack_to_free != get_current_pcb()) {
+        kmem_cache_free(stack_cache, stack_to_free);
+        stack_to_free = NULL;
+    }
+}
+
+/**
+ * @brief empties the process table, limits the number of processes
+ * by the memory and swap found at boot and creates the cache of kernel
+ * stacks, called after \c kmalloc_init and \c swap_init
+ */
+void proc_init() {
+    proc_max = (buddy_total_pages() + swap_total_pages()) / PROC_MIN_PAGES;  /* idle pages can be swapped */
+    if (proc_max > MAX_PROCESS) {
+        proc_max = MAX_PROCESS;
+    }
+    if (!stack_cache) {                             /* aligned for get_current_pcb */
+        stack_cache = kmem_cache_create((const int8_t *)"pcb", KERNEL_STACK_SIZE, KERNEL_STACK_SIZE, proc_stack_ctor);
+    }
+    memset(proc_table, 0, sizeof(proc_table));
+    memset(pid_bitmap, 0, sizeof(pid_bitmap));
+    pid_hint = 0;
+    proc_count = 0;
+    stack_to_free = NULL;
+    proc_list = NULL;
+}
+
+/**
+ * @brief allocates the lowest free pid and a kernel stack with its pcb,
+ * and links the process into the process table
+ *
+ * @param parent the parent of the process, nullable
+ * @return the present pcb with pid, esp0 and links set and the rest
+ * of its state cleared, or NULL if the table is full or out of memory
+ */
+pcb_t *proc_alloc(pcb_t *parent) {
+    uint32_t flags, word, bit;
+    pcb_t *pcb;
+
+    cli_and_save(flags);
+    proc_release_stack();
+    for (word = pid_hint; word < MAX_PROCESS / PID_BITS && !~pid_bitmap[word]; ++word);
+    if (word == MAX_PROCESS / PID_BITS || proc_count >= proc_max) {
+        restore_flags(flags);
+        return NULL;                                /* too many processes */
+    }
+    if (!stack_cache || !(pcb = kmem_cache_alloc(stack_cache))) {
+        restore_flags(flags);
+        return NULL;                                /* out of memory */
+    }
+    asm volatile ("bsfl %1, %0" : "=r"(bit) : "r"(~pid_bitmap[word]));
+    pid_bitmap[word] |= 1 << bit;
+    pid_hint = word;
+    ++proc_count;
+
+    memset(pcb, 0, PCB_RESET_SIZE);                 /* argv and fpu_state are written before use, files left closed */
+    pcb->present = 1;
+    pcb->pid = word * PID_BITS + bit;
+    proc_table[pcb->pid] = pcb;
+
+    if (proc_list) {                                /* joins the live processes */
+        pcb->next = proc_list;
+        pcb->prev = proc_list->prev;
+        proc_list->prev->next = pcb;
+        proc_list->prev = pcb;
+    } else {
+        proc_list = pcb->next = pcb->prev = pcb;
+    }
+    proc_set_parent(pcb, parent);
+    restore_flags(flags);
+    return pcb;
+}
+
+/**
+ * @brief takes a kernel stack with its pcb for a task of the kernel,
+ * such as the idle task; it stays out of the process table, holds no
+ * pid and never counts toward the process limit
+ *
+ * @return the pcb with esp0 set, pid -1 and everything else cleared,
+ * or NULL if out of memory
+ */
+pcb_t *proc_alloc_kernel() {
+    uint32_t flags;
+    pcb_t *pcb;
+
+    cli_and_save(flags);
+    if (!stack_cache || !(pcb = kmem_cache_alloc(stack_cache))) {
+        restore_flags(flags);
+        return NULL;
+    }
+    memset(pcb, 0, PCB_RESET_SIZE);
+    pcb->pid = -1;                                  /* proc_get and proc_list never see it */
+    restore_flags(flags);
+    return pcb;
+}
+
+/**
+ * @brief unlinks \p pcb from the process table and frees its pid and
+ * kernel stack; the stack of the running process is released only
+ * after it has switched away
+ *
+ * @param pcb the process
+ */
+void proc_free(pcb_t *pcb) {
+    uint32_t flags, i;
+    pcb_t *child;
+
+    cli_and_save(flags);
+    proc_set_parent(pcb, NULL);
+    for (child = pcb->children; child; child = pcb->children) {
+        proc_set_parent(child, NULL);               /* nobody waits for them any more */
+    }
+
+    if (pcb->next == pcb) {
+        proc_list = NULL;
+    } else {
+        pcb->prev->next = pcb->next;
+        pcb->next->prev = pcb->prev;
+        if (proc_list == pcb) {
+            proc_list = pcb->next;
+        }
+    }
+    for (i = 0; i < 8; ++i) {
+        pcb->files[i].present = 0;                  /* back to the constructed state */
+    }
+    pcb->present = 0;
+    --proc_count;
+    proc_table[pcb->pid] = NULL;
+    pid_bitmap[pcb->pid / PID_BITS] &= ~(1 << (pcb->pid % PID_BITS));
+    if (pcb->pid / PID_BITS < pid_hint) {
+        pid_hint = pcb->pid / PID_BITS;
+    }
+    proc_release_stack();
+    if (pcb == get_current_pcb()) {
+        stack_to_free = pcb;                        /* still executing on it */
+    } else {
+        kmem_cache_free(stack_cache, pcb);
+    }
+    restore_flags(flags);
+}
+
+/**
+ * @brief finds how many processes may live at once on this machine
+ *
+ * @return the limit, at most MAX_PROCESS
+ */
+uint32_t proc_limit() {
+    return proc_max;
+}
+
+/**
+ * @brief finds the process with \p pid
+ *
+ * @param pid the process id
+ * @return the pcb, NULL if there is no such process
+ */
+pcb_t *proc_get(int32_t pid) {
+    if (pid < 0 || pid >= MAX_PROCESS) {
+        return NULL;
+    }
+    return proc_table[pid];
+}
+
+/**
+ * @brief moves \p pcb to the children of \p parent
+ *
+ * @param pcb the process
+ * @param parent the new parent, nullable
+ */
+void proc_set_parent(pcb_t *pcb, pcb_t *parent) {
+    uint32_t flags;
+    cli_and_save(flags);
+    if (pcb->parent) {                              /* leaves the old parent */
+        if (pcb->sibling_prev) {
+            pcb->sibling_prev->sibling_next = pcb->sibling_next;
+        } else {
+            pcb->parent->children = pcb->sibling_next;
+        }
+        if (pcb->sibling_next) {
+            pcb->sibling_next->sibling_prev = pcb->sibling_prev;
+        }
+    }
+
+    pcb->parent = parent;
+    pcb->sibling_prev = NULL;
+    pcb->sibling_next = NULL;
+    if (parent) {
+        pcb->sibling_next = parent->children;
+        if (parent->children) {
+            parent->children->sibling_prev = pcb;
+        }
+        parent->children = pcb;
+    }
+    restore_flags(flags);
+}
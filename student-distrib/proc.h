@@ -0,0 +1,71 @@
+#ifndef _PROC_H
+#define _PROC_H
+
+#include "lib.h"
+#include "syscall.h"
+
+#define PROC_MIN_PAGES          16                  /* memory kept for each process: stack, tables and some pages */
+
+
+extern pcb_t *proc_list;                            /* any live process, NULL if none */
+
+/**
+ * @brief empties the process table, limits the number of processes
+ * by the memory and swap found at boot and creates the cache of kernel
+ * stacks, called after \c kmalloc_init and \c swap_init
+ */
+void proc_init();
+
+/**
+ * @brief allocates the lowest free pid and a kernel stack with its pcb,
+ * and links the process into the process table
+ *
+ * @param parent the parent of the process, nullable
+ * @return the present pcb with pid, esp0 and links set and the rest
+ * of its state cleared, or NULL if the table is full or out of memory
+ */
+pcb_t *proc_alloc(pcb_t *parent);
+
+/**
+ * @brief takes a kernel stack with its pcb for a task of the kernel,
+ * such as the idle task; it stays out of the process table, holds no
+ * pid and never counts toward the process limit
+ *
+ * @return the pcb with esp0 set, pid -1 and everything else cleared,
+ * or NULL if out of memory
+ */
+pcb_t *proc_alloc_kernel();
+
+/**
+ * @brief unlinks \p pcb from the process table and frees its pid and
+ * kernel stack; the stack of the running process is released only
+ * after it has switched away
+ *
+ * @param pcb the process
+ */
+void proc_free(pcb_t *pcb);
+
+/**
+ * @brief finds how many processes may live at once on this machine
+ *
+ * @return the limit, at most MAX_PROCESS
+ */
+uint32_t proc_limit();
+
+/**
+ * @brief finds the process with \p pid
+ *
+ * @param pid the process id
+ * @return the pcb, NULL if there is no such process
+ */
+pcb_t *proc_get(int32_t pid);
+
+/**
+ * @brief moves \p pcb to the children of \p parent
+ *
+ * @param pcb the process
+ * @param parent the new parent, nullable
+ */
+void proc_set_parent(pcb_t *pcb, pcb_t *parent);
+
+#endif
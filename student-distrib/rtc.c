@@ -1,6 +1,8 @@
 #include "rtc.h"
 #include "i8259.h"
 #include "syscall.h"
+#include "sched.h"
+#include "softirq.h"
 
 #define RTC_COMMAND     0x70
 #define RTC_DATA        0x71
@@ -10,7 +12,12 @@
 #define RTC_REG_C       0x0C
 #define RTC_DISABLE_NMI 0x80
 
-extern pcb_t *pcbs[MAX_PROCESS];
+static pcb_t *rtc_list = NULL;                      /* processes with RTC opened */
+static wait_queue_t rtc_readers = { NULL, NULL };   /* processes sleeping in rtc_read */
+static uint32_t rtc_ticks = 0;                      /* interrupts not yet counted by the bottom half */
+
+static void rtc_bottom_half(uint32_t data);
+static tasklet_t rtc_tasklet = { rtc_bottom_half, 0, 0, NULL };
 
 void rtc_set_rate(uint32_t rate) {
     if (rate < 2 || rate > 15) {
@@ -40,19 +47,79 @@ void rtc_init() {
 void rtc_handler() {
     outb(RTC_REG_C, RTC_COMMAND);
     inb(RTC_DATA);                  /* refreshes the RTC, or squeezed*/
+    ++rtc_ticks;
+    tasklet_schedule(&rtc_tasklet);
+    send_eoi(RTC_IRQ);
+}
 
-    int32_t pid;
-    for (pid = 3; pid < 6; ++pid) {
-        if (pcbs[pid]->present && pcbs[pid]->rtc && !pcbs[pid]->rtc_fired) {
-            if (pcbs[pid]->rtc_curr <= 1) {
-                ++pcbs[pid]->rtc_fired;
+/**
+ * @brief bottom half of the RTC, counts the interrupts down for every
+ * process with RTC opened and wakes the ones whose time is up
+ * 
+ * @param data [ignored]
+ */
+static void rtc_bottom_half(uint32_t data) {
+    uint32_t flags, ticks, fired = 0;
+    pcb_t *pcb;
+    cli_and_save(flags);
+    ticks = rtc_ticks;
+    rtc_ticks = 0;
+    for (pcb = rtc_list; pcb; pcb = pcb->rtc_next) {
+        if (!pcb->rtc_fired) {
+            if (pcb->rtc_curr <= ticks) {
+                ++pcb->rtc_fired;
+                fired = 1;
             } else {
-                --pcbs[pid]->rtc_curr;    /* normal decrement */
+                pcb->rtc_curr -= ticks;     /* normal decrement */
             }
         }
     }
+    if (fired) {
+        wait_queue_wake_all(&rtc_readers);  /* the others go back to sleep */
+    }
+    restore_flags(flags);
+}
 
-    send_eoi(RTC_IRQ);
+/**
+ * @brief adds \p pcb to the processes counting RTC interrupts
+ * 
+ * @param pcb the process
+ */
+void rtc_attach(pcb_t *pcb) {
+    uint32_t flags;
+    cli_and_save(flags);
+    if (!pcb->rtc) {
+        pcb->rtc = 1;
+        pcb->rtc_prev = NULL;
+        pcb->rtc_next = rtc_list;
+        if (rtc_list) {
+            rtc_list->rtc_prev = pcb;
+        }
+        rtc_list = pcb;
+    }
+    restore_flags(flags);
+}
+
+/**
+ * @brief removes \p pcb from the processes counting RTC interrupts
+ * 
+ * @param pcb the process
+ */
+void rtc_detach(pcb_t *pcb) {
+    uint32_t flags;
+    cli_and_save(flags);
+    if (pcb->rtc) {
+        pcb->rtc = 0;
+        if (pcb->rtc_prev) {
+            pcb->rtc_prev->rtc_next = pcb->rtc_next;
+        } else {
+            rtc_list = pcb->rtc_next;
+        }
+        if (pcb->rtc_next) {
+            pcb->rtc_next->rtc_prev = pcb->rtc_prev;
+        }
+    }
+    restore_flags(flags);
 }
 
 /**
@@ -63,7 +130,7 @@ void rtc_handler() {
  */
 int32_t rtc_open(const uint8_t *path) {
     pcb_t *curr = get_current_pcb();
-    curr->rtc = 1;
+    rtc_attach(curr);
     curr->rtc_fired = 0;
     curr->rtc_curr = curr->rtc_rate = RTC_MAX_FREQ / RTC_MIN_FREQ;
     return 0;
@@ -76,7 +143,7 @@ int32_t rtc_open(const uint8_t *path) {
  * @return 0
  */
 int32_t rtc_close(int32_t fd) {
-    get_current_pcb()->rtc = 0;
+    rtc_detach(get_current_pcb());
     return 0;
 }
 
@@ -90,18 +157,18 @@ int32_t rtc_close(int32_t fd) {
  */
 int32_t rtc_read(int32_t fd, void *buf, uint32_t count) {
     pcb_t *curr = get_current_pcb();
+    cli();
     curr->rtc_fired = 0;
-    while (0xDEADBEEF) {
-        if (!curr->rtc) {
-            return -1;
-        }
-        if (curr->rtc_fired > 0) {
-            --curr->rtc_fired;
-            curr->rtc_curr = curr->rtc_rate;
-            return 0;
-        }
+    while (curr->rtc && !curr->rtc_fired) {
+        wait_queue_sleep(&rtc_readers);
     }
-    
+    sti();
+
+    if (!curr->rtc) {
+        return -1;
+    }
+    --curr->rtc_fired;
+    curr->rtc_curr = curr->rtc_rate;
     return 0;
 }
 
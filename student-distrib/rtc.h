@@ -18,6 +18,20 @@ void rtc_init();
 /* handles rtc interrupts */
 void rtc_handler();
 
+/**
+ * @brief adds \p pcb to the processes counting RTC interrupts
+ * 
+ * @param pcb the process
+ */
+void rtc_attach(pcb_t *pcb);
+
+/**
+ * @brief removes \p pcb from the processes counting RTC interrupts
+ * 
+ * @param pcb the process
+ */
+void rtc_detach(pcb_t *pcb);
+
 /**
  * @brief initializes RTC
  * 
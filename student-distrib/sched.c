@@ -4,31 +4,100 @@
 #include "syscall.h"
 #include "paging.h"
 #include "term.h"
+#include "image.h"
+#include "proc.h"
+#include "fpu.h"
+#include "softirq.h"
+#include "frame.h"
 
-#define EXECUTABLE_MAGIC        0x464C457F
 #define HIDDEN_PDE_OFFSET       0xBA
 
 #define PIT_FREQUENCY           1193182
-#define PIT_SQUARE_MODE         0x36
+#define PIT_ONESHOT_MODE        0x30                /* channel 0, lobyte/hibyte, interrupt on terminal count */
+#define SCHED_QUANTUM           (PIT_FREQUENCY / 100)   /* PIT counts in a 10 ms time slice */
+#define SCHED_LEVELS            3                   /* priority levels of the feedback queue */
+#define SCHED_SLICES(level)     (1 << (level))      /* time slices before demotion: 10, 20, 40 ms */
+#define SCHED_BOOST_SLICES      100                 /* everything goes back to the top once a second */
 
 #define PIT_CHANNEL_0           0x40
 #define PIT_CHANNEL_1           0x41
 #define PIT_CHANNEL_2           0x42
 #define PIT_COMMAND             0x43
+#define PIT_LATCH               0x00                /* channel 0, latches the count for reading */
 
-extern pcb_t *pcbs[MAX_PROCESS];
+#define TIMER_MAX_MS            50                  /* longest one-shot while idle, below 65536 counts */
 
 void iret_wrapper() {
     asm volatile ("iret_exec: iret");
 }
 
-void pit_init(uint16_t frequency) {
-    uint16_t param = PIT_FREQUENCY / frequency;
+static pcb_t *idle_task = NULL;                     /* runs when nothing else can, never queued */
+static void sched_idle();
 
-    outb(PIT_SQUARE_MODE, PIT_COMMAND);
-    outb((uint8_t)(param & 0xFF), PIT_CHANNEL_0);           /* send the frequency byte by byte */
-    outb((uint8_t)((param >> 8) & 0xFF), PIT_CHANNEL_0);    /* shift right and reserve last 8 bytes*/
+static uint32_t pit_armed = 0;                      /* counts of the pending one-shot, 0 if none */
+static uint32_t pit_counted = 0;                    /* counts of it already added to the clock */
+static uint32_t pit_residue = 0;                    /* counts times 1000 short of the next ms */
+static uint32_t timer_ms = 0;                       /* milliseconds, advancing while the PIT is armed */
+static pcb_t *timer_queue = NULL;                   /* sleepers, the earliest deadline first */
 
+/**
+ * @brief adds the time passed on the pending one-shot to the clock
+ */
+static void timer_update() {
+    uint32_t remaining, elapsed;
+    if (!pit_armed) {
+        return;
+    }
+    outb(PIT_LATCH, PIT_COMMAND);
+    remaining = inb(PIT_CHANNEL_0);
+    remaining |= inb(PIT_CHANNEL_0) << 8;
+
+    if (remaining && remaining <= pit_armed) {
+        elapsed = pit_armed - remaining;
+    } else {
+        elapsed = pit_armed;                        /* fired, the count wrapped past 0 */
+    }
+    if (elapsed > pit_counted) {
+        pit_residue += (elapsed - pit_counted) * 1000;
+        pit_counted = elapsed;
+        timer_ms += pit_residue / PIT_FREQUENCY;
+        pit_residue %= PIT_FREQUENCY;
+    }
+    if (elapsed == pit_armed) {
+        pit_armed = 0;
+    }
+}
+
+/**
+ * @brief wakes every sleeper whose deadline has passed
+ */
+static void timer_expire() {
+    pcb_t *pcb;
+    while (timer_queue && (int32_t)(timer_ms - timer_queue->wake_time) >= 0) {
+        pcb = timer_queue;
+        timer_queue = pcb->timer_next;
+        pcb->timer_next = NULL;
+        sched_wake(pcb);
+    }
+}
+
+/**
+ * @brief fires the PIT once after \p count ticks, it stays silent
+ * until armed again
+ * 
+ * @param count ticks of PIT_FREQUENCY before the interrupt
+ */
+static void pit_arm(uint16_t count) {
+    timer_update();                                         /* the old one-shot stops counting */
+    pit_armed = count;
+    pit_counted = 0;
+    outb(PIT_ONESHOT_MODE, PIT_COMMAND);
+    outb((uint8_t)(count & 0xFF), PIT_CHANNEL_0);           /* send the count byte by byte */
+    outb((uint8_t)((count >> 8) & 0xFF), PIT_CHANNEL_0);    /* shift right and reserve last 8 bytes*/
+}
+
+void pit_init() {
+    pit_arm(SCHED_QUANTUM);                 /* the first time slice */
     enable_irq(0);                          /* enable the interrupt 0x20 in PIC */
 }
 
@@ -36,10 +105,6 @@ void initiate_shells() {
     extern file_operations_t stdin_ops;
     extern file_operations_t stdout_ops;
 
-    page_directories[USER_ENTRY].MB.present = 1;
-    page_directories[USER_ENTRY].MB.user_supervisor = 1;
-    page_directories[USER_ENTRY].MB.read_write = 1;
-
     page_table_kernel_vidmem[VIDMEM_INDEX + 1].present = 1;     /* 0xB9000: physical 0xB8000 */
     page_table_kernel_vidmem[VIDMEM_INDEX + 1].page_base_address = VIDMEM_INDEX;
     page_table_kernel_vidmem[VIDMEM_INDEX + 2].present = 1;     /* 0xBA000: first terminal */
@@ -48,37 +113,40 @@ void initiate_shells() {
     // page_table_kernel_vidmem[VIDMEM_INDEX + 5].present = 1;     /* 0xBD000: fourth terminal */
 
     int32_t pid;
-    uint32_t magic;
+    elf_t elf;
     dentry_t de;
     if (read_dentry_by_name((const uint8_t *)"shell", &de) == -1
-        || read_data(de.inode_num, 0, (uint8_t *)&magic, sizeof(uint32_t)) == -1
-        || magic != EXECUTABLE_MAGIC) {
+        || image_elf(de.inode_num, &elf) == -1) {
         printf("Executable shell was not found!");
         return;
     }
 
     int i;
-    uint8_t entry[4];
     pcb_t *pcb;
-    for (pid = TERMINAL_COUNT - 1; pid >= 0; --pid) {
+    for (pid = 0; pid < TERMINAL_COUNT; ++pid) {
         /* initializes termial struct for each terminal */
         terms[pid].pid = pid;
         memset(terms[pid].input.content, 0, MAX_TERMINAL);
         terms[pid].input.length = 0;
         terms[pid].input.in_progress = 0;
         terms[pid].input.to_be_halt = 0;
+        terms[pid].input.readers.head = NULL;
+        terms[pid].input.readers.tail = NULL;
         terms[pid].cursor.x = 0;
         terms[pid].cursor.y = 0;
 
         /* initializes pcb for each terminal */
-        pcb = pcbs[pid];
-        pcb->present = 1;
-        pcb->vidmap = 0;
-        pcb->rtc = 0;
-        pcb->pid = pid;
-        pcb->parent = NULL;                                 /* terminal does not have parent */
+        pcb = proc_alloc(NULL);                             /* the first pids go to the terminals */
+        if (!pcb) {
+            printf("No process for shell %d!", pid);
+            return;
+        }
+        pcb->term_id = pid;                                 /* shell i runs on terminal i */
         pcb->parent_ebp = 0;                                /* never halt terminal */
-        pcb->esp0 = KERNEL_STACK - KERNEL_STACK_SIZE * pid; /* stores kernel stack */
+        pcb->image = image_get(de.inode_num);               /* all three share one cached image */
+        pcb->inode = de.inode_num;
+        pcb->elf = elf;
+        heap_init(pcb);                                     /* brk and mmap start after the segments */
         
         pcb->files[0].present = 1;                          /* initiates file descriptor */
         pcb->files[0].ops = &stdin_ops;
@@ -88,15 +156,10 @@ void initiate_shells() {
             pcb->files[i].present = 0;
         }
 
-        page_directories[USER_ENTRY].MB.page_base_address = 2 + pid;
-        asm volatile (                                      /* flushes the TLB */
-            "movl %%cr3, %%eax\n"                           /* copies the shell's image */
-            "movl %%eax, %%cr3\n"
-            :::"eax"
-        );
-
-        read_data(de.inode_num, 24, (uint8_t *)entry, sizeof(entry));  /* gets the entry */
-        read_data(de.inode_num, 0, (uint8_t *)PROGRAM_IMAGE, PROGRAM_IMAGE_LIMIT);
+        if (paging_new_user(pcb) == -1) {                   /* the shell is loaded as it runs */
+            printf("Out of memory for shell %d!", pid);
+            return;
+        }
 
         asm volatile (
             "movl %%esp, %%esi\n"
@@ -114,26 +177,34 @@ void initiate_shells() {
             : "r"((uint32_t)USER_DS),
               "g"((uint32_t)USER_STACK),
               "g"((uint32_t)USER_CS),
-              "r"(((uint32_t)entry[3] << 24)
-                  | ((uint32_t)entry[2] << 16)
-                  | ((uint32_t)entry[1] << 8)
-                  | ((uint32_t)entry[0])),
+              "r"(elf.entry),
               "g"(pcb->esp0)
             : "esi"
         );
     }
 
+    idle_task = proc_alloc_kernel();                    /* no pid, never on proc_list */
+    if (!idle_task) {
+        printf("Out of memory for the idle task!");
+        return;
+    }
+    uint32_t *stack = (uint32_t *)idle_task->esp0;
+    *--stack = (uint32_t)sched_idle;                    /* sched_switch returns into the idle loop */
+    *--stack = 0;                                       /* ebp popped by sched_switch */
+    idle_task->ebp = (uint32_t)stack;
+
+    for (pid = 1; pid < TERMINAL_COUNT; ++pid) {
+        sched_ready(proc_get(pid));                     /* the first shell starts running */
+    }
+    pcb = proc_get(0);
     uint32_t ebp0 = pcb->ebp;
     tss.esp0 = pcb->esp0;
     tss.ss0 = KERNEL_DS;
-
-    asm volatile (                                      /* flushes the TLB */
-        "movl %%cr3, %%eax\n"
-        "movl %%eax, %%cr3\n"
-        :::"eax"
-    );
+    paging_set_user(pcb);
+    fpu_switch(pcb);
     
-    pit_init(100);
+    cli();                                              /* no scheduling before the first shell runs */
+    pit_init();
     set_screen_coordinate(0, 0);
     
     asm volatile (
@@ -145,45 +216,296 @@ void initiate_shells() {
     );
 }
 
-void pit_handler() {
-    send_eoi(0);
+static pcb_t *run_queues[SCHED_LEVELS];             /* ready processes per level, the heads run next */
+static uint32_t sched_slices = 0;                   /* time slices used since the last boost */
+
+/**
+ * @brief finds the queue \p pcb waits in, processes on the shown
+ * terminal are one level above their priority
+ * 
+ * @param pcb the process
+ * @return the level of the queue
+ */
+static uint32_t sched_level(pcb_t *pcb) {
+    if (pcb->priority && pcb->term_id == shown_term_id) {
+        return pcb->priority - 1;
+    }
+    return pcb->priority;
+}
+
+/**
+ * @brief appends \p pcb to the run queue of its level, it is then ready
+ * 
+ * @param pcb the process
+ */
+void sched_ready(pcb_t *pcb) {
+    uint32_t flags;
+    pcb_t **queue = run_queues + sched_level(pcb);
+    cli_and_save(flags);
+    if (pcb->state != PROC_READY) {
+        pcb->state = PROC_READY;
+        if (*queue) {
+            pcb->run_next = *queue;
+            pcb->run_prev = (*queue)->run_prev;
+            (*queue)->run_prev->run_next = pcb;
+            (*queue)->run_prev = pcb;
+        } else {
+            *queue = pcb->run_next = pcb->run_prev = pcb;
+        }
+    }
+    restore_flags(flags);
+}
+
+/**
+ * @brief takes the head of the highest non-empty run queue
+ * 
+ * @return the process to run next, NULL if none is ready
+ */
+static pcb_t *sched_dequeue() {
+    uint32_t level;
+    pcb_t *pcb;
+    for (level = 0; level < SCHED_LEVELS && !run_queues[level]; ++level);
+    if (level == SCHED_LEVELS) {
+        return NULL;
+    }
+
+    pcb = run_queues[level];
+    if (pcb->run_next == pcb) {
+        run_queues[level] = NULL;
+    } else {
+        pcb->run_prev->run_next = pcb->run_next;
+        pcb->run_next->run_prev = pcb->run_prev;
+        run_queues[level] = pcb->run_next;
+    }
+    pcb->run_next = pcb->run_prev = NULL;
+    return pcb;
+}
+
+/**
+ * @brief checks if a process above the level of \p pcb is ready
+ * 
+ * @param pcb the running process
+ * @return 1 if \p pcb should give the processor away, 0 if not
+ */
+static int32_t sched_preempted(pcb_t *pcb) {
+    uint32_t level;
+    for (level = 0; level < sched_level(pcb); ++level) {
+        if (run_queues[level]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief moves every process back to the top level, so that demoted
+ * ones do not starve
+ */
+static void sched_boost() {
+    uint32_t level;
+    pcb_t *pcb = proc_list, *head, *tail;
+    do {
+        pcb->priority = 0;
+        pcb->ticks = 0;
+    } while ((pcb = pcb->next) != proc_list);
+
+    for (level = 1; level < SCHED_LEVELS; ++level) {
+        if (!(head = run_queues[level])) {
+            continue;
+        }
+        run_queues[level] = NULL;
+        if (!run_queues[0]) {
+            run_queues[0] = head;
+            continue;
+        }
+        tail = head->run_prev;                      /* appends the whole queue to the top one */
+        head->run_prev = run_queues[0]->run_prev;
+        run_queues[0]->run_prev->run_next = head;
+        tail->run_next = run_queues[0];
+        run_queues[0]->run_prev = tail;
+    }
+}
+
+/**
+ * @brief marks the current process blocked on \p reason, the caller
+ * gives the processor away with \c schedule
+ * 
+ * @param reason what the process waits for
+ */
+void sched_block(uint8_t reason) {
+    pcb_t *curr = get_current_pcb();
+    curr->state = PROC_BLOCKED;
+    curr->blocked = reason;
+}
+
+/**
+ * @brief makes \p pcb ready if it is blocked
+ * 
+ * @param pcb the process
+ */
+void sched_wake(pcb_t *pcb) {
+    if (pcb->state == PROC_BLOCKED) {
+        pcb->blocked = 0;
+        sched_ready(pcb);
+    }
+}
+
+/**
+ * @brief puts the current process to sleep on \p queue until it is
+ * woken; called with interrupts off, the caller checks its condition
+ * again after it returns
+ * 
+ * @param queue the wait queue
+ */
+void wait_queue_sleep(wait_queue_t *queue) {
+    pcb_t *curr = get_current_pcb();
+    curr->wait_next = NULL;
+    if (queue->tail) {
+        queue->tail->wait_next = curr;
+    } else {
+        queue->head = curr;
+    }
+    queue->tail = curr;
+    sched_block(PROC_BLOCKED_QUEUE);
+    schedule();
+}
+
+/**
+ * @brief wakes every process sleeping on \p queue
+ * 
+ * @param queue the wait queue
+ */
+void wait_queue_wake_all(wait_queue_t *queue) {
+    uint32_t flags;
+    pcb_t *pcb, *next;
+    cli_and_save(flags);
+    pcb = queue->head;
+    queue->head = queue->tail = NULL;
+    for (; pcb; pcb = next) {
+        next = pcb->wait_next;
+        pcb->wait_next = NULL;
+        sched_wake(pcb);
+    }
+    restore_flags(flags);
+}
+
+/**
+ * @brief blocks the current process for \p ms milliseconds, or until
+ * \c timer_wake cuts the sleep short
+ * 
+ * @param ms the time to sleep, below 2^31
+ */
+void timer_sleep(uint32_t ms) {
+    uint32_t flags;
+    pcb_t *curr = get_current_pcb(), **pos;
+    cli_and_save(flags);
+    timer_update();
+    curr->wake_time = timer_ms + ms;
+    for (pos = &timer_queue; *pos && (int32_t)((*pos)->wake_time - curr->wake_time) <= 0;
+         pos = &(*pos)->timer_next);
+    curr->timer_next = *pos;                        /* after the sleepers with the same deadline */
+    *pos = curr;
+    sched_block(PROC_BLOCKED_SLEEP);
+    schedule();
+    restore_flags(flags);
+}
+
+/**
+ * @brief wakes \p pcb right away if it sleeps in \c timer_sleep
+ * 
+ * @param pcb the process, or NULL
+ */
+void timer_wake(pcb_t *pcb) {
+    uint32_t flags;
+    pcb_t **pos;
+    if (!pcb) {
+        return;
+    }
+    cli_and_save(flags);
+    if (pcb->state == PROC_BLOCKED && pcb->blocked == PROC_BLOCKED_SLEEP) {
+        for (pos = &timer_queue; *pos != pcb; pos = &(*pos)->timer_next);
+        *pos = pcb->timer_next;
+        pcb->timer_next = NULL;
+        sched_wake(pcb);
+    }
+    restore_flags(flags);
+}
+
+/**
+ * @brief arms the PIT for the earliest sleeper, the idle task is
+ * tickless if there is none
+ */
+static void timer_arm_idle() {
+    int32_t left;
+    if (!timer_queue) {
+        return;
+    }
+    timer_update();
+    left = timer_queue->wake_time - timer_ms;
+    if (left < 1) {
+        left = 1;                                   /* expired, the interrupt wakes it */
+    }
+    pit_arm(left >= TIMER_MAX_MS ? TIMER_MAX_MS * PIT_FREQUENCY / 1000 : left * PIT_FREQUENCY / 1000);
+}
+
+/**
+ * @brief switches from the current process to \p next, which returns
+ * from its own call to \c sched_switch (or enters user mode for the
+ * first time); the current process continues as it is switched back
+ * 
+ * @param next the process to run
+ */
+void sched_switch(pcb_t *next) {
+    pcb_t *curr = get_current_pcb();
+    next->state = PROC_RUNNING;
+    if (next != idle_task) {
+        pit_arm(SCHED_QUANTUM);                     /* the idle task runs tickless */
+    }
+    if (next == curr) {
+        if (curr->pid == terms[curr->term_id].pid && terms[curr->term_id].input.to_be_halt) {
+            halt(6);                                /* user pressed ctrl + C on this terminal */
+        }
+        return;
+    }
+    if (next == idle_task) {                        /* keeps the screen and memory of the last process */
+        asm volatile (
+            "movl %%ebp, %0     \n"
+            "movl %1, %%esp     \n"
+            "popl %%ebp         \n"
+            "ret                \n"
+            : "=m"(curr->ebp)
+            : "r"(next->ebp)
+        );
+    }
 
     get_screen_coordinate(
         &terms[active_term_id].cursor.x,
         &terms[active_term_id].cursor.y
     );                                              /* records the screen coordiante */
-    
-    uint32_t next_id = (active_term_id + 1) % TERMINAL_COUNT;
-    if (next_id == shown_term_id) {                 /* setup paging for video memory*/
-        page_table_kernel_vidmem[VIDMEM_INDEX].page_base_address = VIDMEM_INDEX;
-        page_table_user_vidmem[VIDMEM_INDEX].page_base_address = VIDMEM_INDEX;
+
+    uint32_t next_id = next->term_id;
+    paging_set_vidmem(next_id);                     /* setup paging for video memory*/
+    if (next_id == shown_term_id) {
         set_cursor_pos(terms[next_id].cursor.x, terms[next_id].cursor.y);
-    } else {
-        page_table_kernel_vidmem[VIDMEM_INDEX].page_base_address = VIDMEM_INDEX + next_id + 2;
-        page_table_user_vidmem[VIDMEM_INDEX].page_base_address = VIDMEM_INDEX + next_id + 2;
     }
 
     set_screen_coordinate(terms[next_id].cursor.x, terms[next_id].cursor.y);
-
     active_term_id = next_id;
-    pcb_t *curr = get_current_pcb(), *next = pcbs[terms[next_id].pid];
 
     asm volatile (
         "movl %%ebp, %0\n"                          /* stores old ebp to return back */
         : "=g"(curr->ebp)
     );
 
-    curr->esp0 = tss.esp0;
+    if (curr != idle_task) {
+        curr->esp0 = tss.esp0;
+    }
     tss.esp0 = next->esp0;
-    page_directories[USER_ENTRY].MB.page_base_address = 2 + next->pid;
     page_table_user_vidmem[VIDMEM_INDEX].present = next->vidmap;
+    paging_set_user(next);                          /* drops the user pages of curr from the TLB */
+    fpu_switch(next);                               /* the first FPU instruction loads its state */
 
-    asm volatile (                                  /* flushes the TLB */
-        "movl %%cr3, %%eax\n"
-        "movl %%eax, %%cr3\n"
-        :::"eax"
-    );
-
+    uint32_t to_be_halt = next->pid == terms[next_id].pid && terms[next_id].input.to_be_halt;
     asm volatile (
         "movl %0, %%esp     \n"                     /* equivalent to leave, but one line less */
         "popl %%ebp         \n"
@@ -195,8 +517,69 @@ void pit_handler() {
         "pushl $6           \n"
         "call halt          \n"                     /* halt and reexecute */
         :
-        : "g"(next->ebp),
-          "g"(terms[next_id].input.to_be_halt)
+        : "r"(next->ebp),
+          "r"(to_be_halt)
         : "cc"
     );
 }
+
+/**
+ * @brief gives the processor away after the current process stopped
+ * being runnable, returns as it is runnable and scheduled again
+ */
+void schedule() {
+    pcb_t *next = sched_dequeue();
+    sched_switch(next ? next : idle_task);          /* nothing can run, halts in the idle task */
+}
+
+/**
+ * @brief body of the idle task, refills the pool of zeroed frames and
+ * halts the processor until an interrupt makes some process ready,
+ * then runs it
+ */
+static void sched_idle() {
+    pcb_t *next;
+    while (1) {
+        do_softirq();                               /* bottom halves of the interrupt that woke it */
+        cli();
+        if ((next = sched_dequeue())) {
+            sched_switch(next);                     /* back here as everything blocks again */
+        } else if (frame_zero_wanted()) {
+            sti();
+            frame_zero_one();                       /* a process woken meanwhile waits one page at most */
+        } else {
+            timer_arm_idle();
+            asm volatile ("sti; hlt");              /* no interrupt slips in before hlt */
+        }
+    }
+}
+
+void pit_handler() {
+    send_eoi(0);
+    pcb_t *curr = get_current_pcb();
+    timer_update();
+    timer_expire();
+    if (curr == idle_task || curr->state != PROC_RUNNING) {
+        return;                                     /* a late tick, the idle task picks the next one */
+    }
+    if (in_softirq()) {
+        pit_arm(SCHED_QUANTUM);                     /* bottom halves are not preempted */
+        return;
+    }
+    if (++sched_slices >= SCHED_BOOST_SLICES) {
+        sched_slices = 0;
+        sched_boost();
+    }
+
+    if (++curr->ticks >= SCHED_SLICES(curr->priority)) {
+        curr->ticks = 0;                            /* used the whole quantum, goes down a level */
+        if (curr->priority < SCHED_LEVELS - 1) {
+            ++curr->priority;
+        }
+    } else if (!sched_preempted(curr)) {
+        sched_switch(curr);                         /* continues its quantum */
+        return;
+    }
+    sched_ready(curr);
+    sched_switch(sched_dequeue());                  /* may be curr if nothing else can run */
+}
@@ -5,4 +5,72 @@
 
 void initiate_shells();
 
+/**
+ * @brief appends \p pcb to the run queue, it is then ready
+ * 
+ * @param pcb the process
+ */
+void sched_ready(pcb_t *pcb);
+
+/**
+ * @brief marks the current process blocked on \p reason, the caller
+ * gives the processor away with \c schedule
+ * 
+ * @param reason what the process waits for
+ */
+void sched_block(uint8_t reason);
+
+/**
+ * @brief makes \p pcb ready if it is blocked
+ * 
+ * @param pcb the process
+ */
+void sched_wake(pcb_t *pcb);
+
+/**
+ * @brief puts the current process to sleep on \p queue until it is
+ * woken; called with interrupts off, the caller checks its condition
+ * again after it returns
+ * 
+ * @param queue the wait queue
+ */
+void wait_queue_sleep(wait_queue_t *queue);
+
+/**
+ * @brief wakes every process sleeping on \p queue
+ * 
+ * @param queue the wait queue
+ */
+void wait_queue_wake_all(wait_queue_t *queue);
+
+/**
+ * @brief blocks the current process for \p ms milliseconds, or until
+ * \c timer_wake cuts the sleep short
+ * 
+ * @param ms the time to sleep, below 2^31
+ */
+void timer_sleep(uint32_t ms);
+
+/**
+ * @brief wakes \p pcb right away if it sleeps in \c timer_sleep
+ * 
+ * @param pcb the process, or NULL
+ */
+void timer_wake(pcb_t *pcb);
+
+/**
+ * @brief switches from the current process to \p next, which returns
+ * from its own call to \c sched_switch (or enters user mode for the
+ * first time); the current process continues as it is switched back
+ * 
+ * @param next the process to run
+ */
+void sched_switch(pcb_t *next);
+
+/**
+ * @brief gives the processor away after the current process stopped
+ * being runnable, returns as it is runnable and scheduled again
+ */
+void schedule();
+
 #endif
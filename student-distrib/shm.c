@@ -0,0 +1,212 @@
+#include "shm.h"
+#include "paging.h"
+#include "frame.h"
+
+#define PAGE_SIZE               0x1000
+
+static shm_t segments[SHM_MAX];
+
+/**
+ * @brief releases the frames of \p seg and empties its slot
+ *
+ * @param seg the segment, attached nowhere
+ */
+static void shm_free(shm_t *seg) {
+    uint32_t i;
+    for (i = 0; i < seg->pages; ++i) {
+        frame_put(seg->frames[i]);              /* mappings have let theirs go */
+    }
+    seg->present = 0;
+}
+
+/**
+ * @brief maps the segment \p id to the user pages of \p pcb, below its
+ * stack
+ *
+ * @param pcb the process
+ * @param id the segment returned by \c shm_create
+ * @return the start of the mapping, 0 if fail
+ */
+uint32_t shm_map(pcb_t *pcb, uint32_t id) {
+    uint32_t flags, i, start;
+    shm_t *seg = segments + id;
+    shm_map_t *map = NULL;
+
+    cli_and_save(flags);
+    for (i = 0; i < SHM_PER_PROCESS; ++i) {
+        if (!pcb->shm[i].addr) {
+            map = pcb->shm + i;
+            break;
+        }
+    }
+    if (id >= SHM_MAX || !seg->present || !map
+        || !(start = paging_find_user(pcb, seg->pages * PAGE_SIZE))) {
+        restore_flags(flags);
+        return 0;
+    }
+    paging_share_user(pcb, start, seg->frames, seg->pages);
+    ++seg->attaches;
+    map->id = id;
+    map->addr = start;
+    restore_flags(flags);
+    return start;
+}
+
+/**
+ * @brief unmaps the segment attached at \p addr from \p pcb, freeing it
+ * if no other process has it attached
+ *
+ * @param pcb the process
+ * @param addr the start of the mapping
+ * @return 0 if success, -1 if no segment is attached at \p addr
+ */
+int32_t shm_unmap(pcb_t *pcb, uint32_t addr) {
+    uint32_t flags, i;
+    shm_t *seg;
+
+    cli_and_save(flags);
+    for (i = 0; i < SHM_PER_PROCESS; ++i) {
+        if (addr && pcb->shm[i].addr == addr) {
+            seg = segments + pcb->shm[i].id;
+            paging_unmap_user(pcb, addr, addr + seg->pages * PAGE_SIZE);
+            pcb->shm[i].addr = 0;
+            if (!--seg->attaches) {
+                shm_free(seg);
+            }
+            restore_flags(flags);
+            return 0;
+        }
+    }
+    restore_flags(flags);
+    return -1;
+}
+
+/**
+ * @brief unmaps every segment attached to \p pcb, as its program ends,
+ * and frees the segments it created that nobody has attached
+ *
+ * @param pcb the process
+ */
+void shm_unmap_all(pcb_t *pcb) {
+    uint32_t flags, i;
+    shm_t *seg;
+    for (i = 0; i < SHM_PER_PROCESS; ++i) {
+        shm_unmap(pcb, pcb->shm[i].addr);
+    }
+
+    cli_and_save(flags);
+    for (i = 0, seg = segments; i < SHM_MAX; ++i, ++seg) {
+        if (seg->present && seg->creator == pcb->pid) {
+            seg->creator = -1;
+            if (!seg->attaches) {
+                shm_free(seg);                      /* created but never attached */
+            }
+        }
+    }
+    restore_flags(flags);
+}
+
+/**
+ * @brief attaches the segments of \p parent to \p child as well, whose
+ * page table is a copy of the parent's
+ *
+ * @param parent the forking process
+ * @param child the new process
+ */
+void shm_fork(pcb_t *parent, pcb_t *child) {
+    uint32_t flags, i;
+    cli_and_save(flags);
+    for (i = 0; i < SHM_PER_PROCESS; ++i) {
+        child->shm[i] = parent->shm[i];
+        if (parent->shm[i].addr) {
+            ++segments[parent->shm[i].id].attaches;     /* the frames were held by paging_fork */
+        }
+    }
+    restore_flags(flags);
+}
+
+/**
+ * @brief checks if a segment is attached to \p pcb in [\p start, \p end)
+ *
+ * @param pcb the process
+ * @param start the first page, aligned
+ * @param end the end of the last page, aligned
+ * @return 1 if any page of the range is shared memory, 0 if not
+ */
+int32_t shm_overlaps(pcb_t *pcb, uint32_t start, uint32_t end) {
+    uint32_t i, addr;
+    for (i = 0; i < SHM_PER_PROCESS; ++i) {
+        addr = pcb->shm[i].addr;
+        if (addr && addr < end && addr + segments[pcb->shm[i].id].pages * PAGE_SIZE > start) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief finds the segment named \p key, or creates one of \p size
+ * bytes of zeros
+ *
+ * @param key the name processes agree on
+ * @param size the size in bytes, no larger than an existing segment
+ * @return the id of the segment, -1 if fail
+ */
+int32_t shm_create(uint32_t key, uint32_t size) {
+    uint32_t flags, i, pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    shm_t *seg, *slot = NULL;
+    if (!size || size > SHM_MAX_PAGES * PAGE_SIZE) {
+        return -1;
+    }
+
+    cli_and_save(flags);
+    for (i = 0, seg = segments; i < SHM_MAX; ++i, ++seg) {
+        if (seg->present && seg->key == key) {
+            restore_flags(flags);
+            return pages <= seg->pages ? i : -1;    /* the existing one is shared */
+        }
+        if (!seg->present && !slot) {
+            slot = seg;
+        }
+    }
+    if (!slot) {
+        restore_flags(flags);
+        return -1;
+    }
+
+    for (slot->pages = 0; slot->pages < pages; ++slot->pages) {
+        if (!(slot->frames[slot->pages] = frame_alloc_zeroed())) {
+            shm_free(slot);                         /* gives back the frames taken so far */
+            restore_flags(flags);
+            return -1;
+        }
+    }
+    slot->present = 1;
+    slot->key = key;
+    slot->attaches = 0;
+    slot->creator = get_current_pcb()->pid;         /* holds it until the first attach or its exit */
+    restore_flags(flags);
+    return slot - segments;
+}
+
+/**
+ * @brief maps the segment \p id to the current process
+ *
+ * @param id the segment returned by \c shm_create
+ * @return the start of the mapping, or -1 if fail
+ */
+void *shm_attach(uint32_t id) {
+    uint32_t start = shm_map(get_current_pcb(), id);
+    return start ? (void *)start : (void *)-1;
+}
+
+/**
+ * @brief unmaps the segment attached at \p addr from the current
+ * process; the memory is freed after the last detach
+ *
+ * @param addr the start returned by \c shm_attach
+ * @return 0 if success, -1 if no segment is attached at \p addr
+ */
+int32_t shm_detach(void *addr) {
+    return shm_unmap(get_current_pcb(), (uint32_t)addr);
+}
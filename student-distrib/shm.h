@@ -0,0 +1,95 @@
+#ifndef _SHM_H
+#define _SHM_H
+
+#include "lib.h"
+
+#define SHM_MAX             16                  /* segments in the system */
+#define SHM_MAX_PAGES       64                  /* largest segment, 256 KB */
+
+/**
+ * @brief \c shm_t is a set of frames mapped by several processes
+ */
+typedef struct shm_t {
+    uint32_t present;           /* the slot holds a segment */
+    uint32_t key;               /* the name processes agree on */
+    uint32_t pages;             /* size of the segment in pages */
+    uint32_t attaches;          /* number of mappings, freed with the last detach */
+    int32_t creator;            /* pid of the process that created it, -1 once it left; freed with it if never attached */
+    uint32_t frames[SHM_MAX_PAGES];     /* physical frames, each with one reference of the segment */
+} shm_t;
+
+/**
+ * @brief maps the segment \p id to the user pages of \p pcb, below its
+ * stack
+ *
+ * @param pcb the process
+ * @param id the segment returned by \c shm_create
+ * @return the start of the mapping, 0 if fail
+ */
+uint32_t shm_map(pcb_t *pcb, uint32_t id);
+
+/**
+ * @brief unmaps the segment attached at \p addr from \p pcb, freeing it
+ * if no other process has it attached
+ *
+ * @param pcb the process
+ * @param addr the start of the mapping
+ * @return 0 if success, -1 if no segment is attached at \p addr
+ */
+int32_t shm_unmap(pcb_t *pcb, uint32_t addr);
+
+/**
+ * @brief unmaps every segment attached to \p pcb, as its program ends,
+ * and frees the segments it created that nobody has attached
+ *
+ * @param pcb the process
+ */
+void shm_unmap_all(pcb_t *pcb);
+
+/**
+ * @brief attaches the segments of \p parent to \p child as well, whose
+ * page table is a copy of the parent's
+ *
+ * @param parent the forking process
+ * @param child the new process
+ */
+void shm_fork(pcb_t *parent, pcb_t *child);
+
+/**
+ * @brief checks if a segment is attached to \p pcb in [\p start, \p end)
+ *
+ * @param pcb the process
+ * @param start the first page, aligned
+ * @param end the end of the last page, aligned
+ * @return 1 if any page of the range is shared memory, 0 if not
+ */
+int32_t shm_overlaps(pcb_t *pcb, uint32_t start, uint32_t end);
+
+/**
+ * @brief finds the segment named \p key, or creates one of \p size
+ * bytes of zeros
+ *
+ * @param key the name processes agree on
+ * @param size the size in bytes, no larger than an existing segment
+ * @return the id of the segment, -1 if fail
+ */
+int32_t shm_create(uint32_t key, uint32_t size);
+
+/**
+ * @brief maps the segment \p id to the current process
+ *
+ * @param id the segment returned by \c shm_create
+ * @return the start of the mapping, or -1 if fail
+ */
+void *shm_attach(uint32_t id);
+
+/**
+ * @brief unmaps the segment attached at \p addr from the current
+ * process; the memory is freed after the last detach
+ *
+ * @param addr the start returned by \c shm_attach
+ * @return 0 if success, -1 if no segment is attached at \p addr
+ */
+int32_t shm_detach(void *addr);
+
+#endif
@@ -0,0 +1,64 @@
+#include "softirq.h"
+
+static tasklet_t *tasklet_head = NULL;              /* the next tasklet to run */
+static tasklet_t *tasklet_tail = NULL;              /* the last tasklet scheduled */
+static uint32_t softirq_running = 0;                /* tasklets are being run */
+
+/**
+ * @brief queues \p tasklet to run before the next return to user
+ * space, once however many times it is scheduled until then
+ *
+ * @param tasklet the tasklet
+ */
+void tasklet_schedule(tasklet_t *tasklet) {
+    uint32_t flags;
+    cli_and_save(flags);
+    if (!tasklet->scheduled) {
+        tasklet->scheduled = 1;
+        tasklet->next = NULL;
+        if (tasklet_tail) {
+            tasklet_tail->next = tasklet;
+        } else {
+            tasklet_head = tasklet;
+        }
+        tasklet_tail = tasklet;
+    }
+    restore_flags(flags);
+}
+
+/**
+ * @brief runs every pending tasklet with interrupts enabled, in the
+ * order they were scheduled; does nothing if called from a tasklet
+ */
+void do_softirq() {
+    uint32_t flags;
+    tasklet_t *tasklet;
+    cli_and_save(flags);
+    if (softirq_running) {
+        restore_flags(flags);
+        return;
+    }
+
+    softirq_running = 1;
+    while ((tasklet = tasklet_head)) {
+        if (!(tasklet_head = tasklet->next)) {
+            tasklet_tail = NULL;
+        }
+        tasklet->next = NULL;
+        tasklet->scheduled = 0;                     /* may be scheduled again while it runs */
+        sti();
+        tasklet->func(tasklet->data);
+        cli();
+    }
+    softirq_running = 0;
+    restore_flags(flags);
+}
+
+/**
+ * @brief checks if tasklets are running, which are not preempted
+ *
+ * @return 1 if in a tasklet, 0 if not
+ */
+int32_t in_softirq() {
+    return softirq_running;
+}
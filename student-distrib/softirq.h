@@ -0,0 +1,38 @@
+#ifndef _SOFTIRQ_H
+#define _SOFTIRQ_H
+
+#include "lib.h"
+
+/**
+ * @brief \c tasklet_t is the bottom half of an interrupt handler,
+ * queued by the handler and run later with interrupts enabled
+ */
+typedef struct tasklet_t {
+    void (*func)(uint32_t data);    /* the deferred work */
+    uint32_t data;                  /* passed to func */
+    uint32_t scheduled;             /* queued and not yet started */
+    struct tasklet_t *next;         /* next pending tasklet */
+} tasklet_t;
+
+/**
+ * @brief queues \p tasklet to run before the next return to user
+ * space, once however many times it is scheduled until then
+ *
+ * @param tasklet the tasklet
+ */
+void tasklet_schedule(tasklet_t *tasklet);
+
+/**
+ * @brief runs every pending tasklet with interrupts enabled, in the
+ * order they were scheduled; does nothing if called from a tasklet
+ */
+void do_softirq();
+
+/**
+ * @brief checks if tasklets are running, which are not preempted
+ *
+ * @return 1 if in a tasklet, 0 if not
+ */
+int32_t in_softirq();
+
+#endif
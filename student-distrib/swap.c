@@ -0,0 +1,189 @@
+#include "swap.h"
+#include "paging.h"
+#include "frame.h"
+#include "filesys.h"
+#include "proc.h"
+
+static uint16_t swap_refs[SWAP_MAX_SLOTS];          /* sharers of each slot, 0 if free */
+static uint32_t swap_slots = 0;                     /* slots on the drive, 0 without one */
+static uint32_t swap_used = 0;                      /* slots in use */
+static uint32_t swap_hint = 0;                      /* no free slot below */
+static int32_t hand_pid = -1;                       /* the clock hand: the process */
+static uint32_t hand_index = 0;                     /* the clock hand: the page in its user entry */
+
+/**
+ * @brief looks for the swap drive, the slave of the primary ATA
+ * channel, and empties all slots; swapping is off without the drive
+ */
+void swap_init() {
+    swap_slots = ata_drive_sectors(ATA_SLAVE_DRIVE) / SWAP_SECTORS_PER_PAGE;
+    if (swap_slots > SWAP_MAX_SLOTS) {
+        swap_slots = SWAP_MAX_SLOTS;
+    }
+    memset(swap_refs, 0, sizeof(swap_refs));
+    swap_used = 0;
+    swap_hint = 0;
+    hand_pid = -1;
+    hand_index = 0;
+}
+
+/**
+ * @brief counts the pages the swap drive holds
+ *
+ * @return number of slots, 0 if there is no swap drive
+ */
+uint32_t swap_total_pages() {
+    return swap_slots;
+}
+
+/**
+ * @brief counts the slots in use
+ *
+ * @return number of pages on the swap drive
+ */
+uint32_t swap_used_pages() {
+    return swap_used;
+}
+
+/**
+ * @brief takes one more reference of the slot at \p slot, as a swapped
+ * page is shared by fork
+ *
+ * @param slot the slot recorded in the page table entry
+ */
+void swap_hold(uint32_t slot) {
+    uint32_t flags;
+    cli_and_save(flags);
+    ++swap_refs[slot];
+    restore_flags(flags);
+}
+
+/**
+ * @brief releases one reference of the slot at \p slot, which is free
+ * again with the last one
+ *
+ * @param slot the slot recorded in the page table entry
+ */
+void swap_put(uint32_t slot) {
+    uint32_t flags;
+    cli_and_save(flags);
+    if (swap_refs[slot] && !--swap_refs[slot]) {
+        --swap_used;
+        if (slot < swap_hint) {
+            swap_hint = slot;
+        }
+    }
+    restore_flags(flags);
+}
+
+/**
+ * @brief writes the page at \p pte of \p pcb to a free slot and leaves
+ * the slot in the entry in place of the frame
+ *
+ * @param pcb the process
+ * @param pte the entry of a present, private page
+ * @param addr the user address of the page
+ * @return 0 if success, -1 if the drive is full
+ */
+static int32_t swap_out(pcb_t *pcb, pte_t *pte, uint32_t addr) {
+    uint32_t slot, frame = pte->page_base_address << 12;
+    for (slot = swap_hint; slot < swap_slots && swap_refs[slot]; ++slot);
+    if (slot == swap_slots) {
+        return -1;
+    }
+    swap_hint = slot + 1;
+    swap_refs[slot] = 1;
+    ++swap_used;
+
+    write_ata_drive(ATA_SLAVE_DRIVE, slot * SWAP_SECTORS_PER_PAGE, SWAP_SECTORS_PER_PAGE, (const uint8_t *)frame);
+    pte->present = 0;
+    pte->read_write |= pte->available & PTE_COW ? 1 : 0;   /* no other sharer is left to copy for */
+    pte->available = PTE_SWAPPED;
+    pte->page_base_address = slot;
+    if (pcb == get_current_pcb()) {
+        invlpg(addr);                               /* others flush as CR3 is loaded */
+    }
+    frame_put(frame);
+    return 0;
+}
+
+/**
+ * @brief writes up to \p count private user pages, not used since the
+ * last pass of the clock hand, to the swap drive and frees their frames
+ *
+ * @param count the number of frames wanted
+ * @return number of pages swapped out
+ */
+uint32_t swap_reclaim(uint32_t count) {
+    uint32_t flags, index, addr, rounds = 0, swapped = 0;
+    pcb_t *pcb, *start;
+    pte_t *pte;
+
+    if (!swap_slots) {
+        return 0;
+    }
+
+    cli_and_save(flags);
+    if (hand_pid == -1 || !(pcb = proc_get(hand_pid))) {
+        pcb = proc_list;                            /* the process under the hand is gone */
+        hand_index = 0;
+    }
+    if (!pcb) {
+        restore_flags(flags);
+        return 0;
+    }
+
+    start = pcb;
+    index = hand_index;
+    while (swapped < count && swap_used < swap_slots) {
+        if (index == PAGING_COUNT || !pcb->page_table) {
+            pcb = pcb->next;
+            index = 0;
+            if (pcb == start && ++rounds > 2) {
+                break;                              /* a pass clears the accessed bits, the next evicts */
+            }
+            continue;
+        }
+        pte = pcb->page_table + index;
+        addr = (USER_ENTRY << 22) | (index++ << 12);
+        if (!pte->present || (pte->available & (PTE_IMAGE | PTE_SHARED))
+            || frame_refs(pte->page_base_address << 12) != 1) {
+            continue;                               /* only pages of one process go */
+        }
+        if (pte->accessed) {
+            pte->accessed = 0;                      /* a second chance */
+            if (pcb == get_current_pcb()) {
+                invlpg(addr);                       /* the next access sets it again */
+            }
+            continue;
+        }
+        if (swap_out(pcb, pte, addr) == -1) {
+            break;
+        }
+        ++swapped;
+    }
+    hand_pid = pcb->pid;
+    hand_index = index;
+    restore_flags(flags);
+    return swapped;
+}
+
+/**
+ * @brief reads the page swapped out at \p pte back to a new frame and
+ * maps it again
+ *
+ * @param pte the page table entry, marked PTE_SWAPPED
+ * @return 0 if success, -1 if out of memory
+ */
+int32_t swap_in(pte_t *pte) {
+    uint32_t slot = pte->page_base_address, frame;
+    if (!(frame = frame_alloc())) {
+        return -1;
+    }
+    read_ata_drive(ATA_SLAVE_DRIVE, slot * SWAP_SECTORS_PER_PAGE, SWAP_SECTORS_PER_PAGE, (uint8_t *)frame);
+    swap_put(slot);                                 /* a forked sharer reads its own copy */
+    pte->page_base_address = frame >> 12;
+    pte->available = 0;
+    pte->present = 1;                               /* user and read_write were kept */
+    return 0;
+}
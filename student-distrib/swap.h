@@ -0,0 +1,63 @@
+#ifndef _SWAP_H
+#define _SWAP_H
+
+#include "lib.h"
+
+#define SWAP_MAX_SLOTS          0x4000              /* pages on the swap drive, 64 MB */
+#define SWAP_SECTORS_PER_PAGE   8                   /* 4 KB in 512-byte sectors */
+
+/**
+ * @brief looks for the swap drive, the slave of the primary ATA
+ * channel, and empties all slots; swapping is off without the drive
+ */
+void swap_init();
+
+/**
+ * @brief counts the pages the swap drive holds
+ *
+ * @return number of slots, 0 if there is no swap drive
+ */
+uint32_t swap_total_pages();
+
+/**
+ * @brief counts the slots in use
+ *
+ * @return number of pages on the swap drive
+ */
+uint32_t swap_used_pages();
+
+/**
+ * @brief takes one more reference of the slot at \p slot, as a swapped
+ * page is shared by fork
+ *
+ * @param slot the slot recorded in the page table entry
+ */
+void swap_hold(uint32_t slot);
+
+/**
+ * @brief releases one reference of the slot at \p slot, which is free
+ * again with the last one
+ *
+ * @param slot the slot recorded in the page table entry
+ */
+void swap_put(uint32_t slot);
+
+/**
+ * @brief writes up to \p count private user pages, not used since the
+ * last pass of the clock hand, to the swap drive and frees their frames
+ *
+ * @param count the number of frames wanted
+ * @return number of pages swapped out
+ */
+uint32_t swap_reclaim(uint32_t count);
+
+/**
+ * @brief reads the page swapped out at \p pte back to a new frame and
+ * maps it again
+ *
+ * @param pte the page table entry, marked PTE_SWAPPED
+ * @return 0 if success, -1 if out of memory
+ */
+int32_t swap_in(pte_t *pte);
+
+#endif
@@ -3,17 +3,14 @@
 #include "term.h"
 #include "rtc.h"
 #include "filesys.h"
+#include "image.h"
+#include "sched.h"
+#include "proc.h"
+#include "fpu.h"
+#include "shm.h"
 
-pcb_t *pcbs[MAX_PROCESS] = {
-    (pcb_t *)(KERNEL_STACK - (0x00 + 1) * KERNEL_STACK_SIZE),
-    (pcb_t *)(KERNEL_STACK - (0x01 + 1) * KERNEL_STACK_SIZE),
-    (pcb_t *)(KERNEL_STACK - (0x02 + 1) * KERNEL_STACK_SIZE),
-    (pcb_t *)(KERNEL_STACK - (0x03 + 1) * KERNEL_STACK_SIZE),
-    (pcb_t *)(KERNEL_STACK - (0x04 + 1) * KERNEL_STACK_SIZE),
-    (pcb_t *)(KERNEL_STACK - (0x05 + 1) * KERNEL_STACK_SIZE),
-    // (pcb_t *)(KERNEL_STACK - (0x06 + 1) * KERNEL_STACK_SIZE),
-    // (pcb_t *)(KERNEL_STACK - (0x07 + 1) * KERNEL_STACK_SIZE),
-};
+#define PAGE_SIZE               0x1000
+#define PAGE_UP(x)              (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
 
 int32_t null_open(const uint8_t *file_name) {return -1;}
 int32_t null_read(int32_t fd, void *buf, uint32_t count) {return -1;}
@@ -68,6 +65,39 @@ static file_operations_t *const file_ops_map[] = {
     &file_ops
 };
 
+/**
+ * @brief splits \p command into the file name and the argument
+ * 
+ * @param command user-input command
+ * @param file_name the file name (first part), MAX_TERMINAL bytes
+ * @param argument the added argument (nullable, second), MAX_TERMINAL bytes
+ * @return 0 if success, -1 if there is no command
+ */
+static int32_t parse_command(const uint8_t *command, uint8_t *file_name, uint8_t *argument) {
+    int i = 0;
+    const uint8_t *pos = command;
+    uint8_t *argv_pos;
+
+    memset(file_name, 0, MAX_TERMINAL);
+    memset(argument, 0, MAX_TERMINAL);
+    for (; *pos == ' ' && !(i & ~(MAX_TERMINAL - 1)); ++i, ++pos);
+    if (!*pos) {                                        /* skips spaces before command */
+        return -1;                                      /* no command? */
+    }
+    for (argv_pos = file_name; *pos && *pos != ' ' && !(i & ~(MAX_TERMINAL - 1)); ++i, ++pos, ++argv_pos) {
+        *argv_pos = *pos;                               /* parses command */
+    }
+    for (; *pos == ' ' && !(i & ~(MAX_TERMINAL - 1)); ++i, ++pos);  /* skips spaces between command and arguments*/
+    if (*pos) {                                         /* parses arguments if has*/
+        for (argv_pos = argument; *pos && *pos != ' ' && !(i & ~(MAX_TERMINAL - 1)); ++i, ++pos, ++argv_pos) {
+            *argv_pos = *pos;
+        }
+        *argv_pos = 0;
+    }
+    argument[MAX_TERMINAL - 1] = 0;
+    return 0;
+}
+
 /**
  * @brief terminates the currently executing user program, with exit code \p status
  * 
@@ -77,46 +107,78 @@ static file_operations_t *const file_ops_map[] = {
 int32_t halt(uint8_t status) {
     cli();
     int i;
-    pcb_t *pcb = get_current_pcb();
+    pcb_t *pcb = get_current_pcb(), *child, *parent;
+    uint32_t parent_ebp;
+    extern uint8_t exception_occurred;
 
     /* *************** Reclaim the PCB & Resources *************** */
-    pcb->present = 0;
+    image_put(pcb->image);
+    pcb->image = NULL;
     pcb->vidmap = 0;
-    pcb->rtc = 0;
     for (i = 2; i < 8; ++i) {
         if (pcb->files[i].present) {
             pcb->files[i].ops->close(i);                /* closes all files */
             pcb->files[i].present = 0;                  /* reclaims all resources*/
         }
     }
+    rtc_detach(pcb);
+    fpu_release(pcb);
+    shm_unmap_all(pcb);                                 /* the last process leaving frees a segment */
+    paging_free_user(pcb);                              /* drops its share of copy-on-write pages */
+
+    while ((child = pcb->children)) {                   /* forked children are left to nobody */
+        if (child->state == PROC_ZOMBIE) {
+            proc_free(child);
+        } else {
+            proc_set_parent(child, NULL);
+        }
+    }
     
-    terms[active_term_id].input.to_be_halt = 0;
+    if (terms[pcb->term_id].pid == pcb->pid) {
+        terms[pcb->term_id].input.to_be_halt = 0;
+    }
     if (pcb->pid < TERMINAL_COUNT) {                                /* never closes the terminal */
-        pcb->present = 0;
+        proc_free(pcb);                                             /* the same pid returns, on another stack */
         execute((const uint8_t *)"shell");
     }
 
-    terms[active_term_id].pid = pcb->parent->pid;
+    if (pcb->forked) {                                  /* nobody waits in execute() for it */
+        pcb->state = PROC_ZOMBIE;                       /* never scheduled again */
+        if (pcb->parent) {                              /* reaped by wait() of its parent */
+            pcb->exit_status = exception_occurred ? 0x100 : status;
+            if (pcb->parent->state == PROC_BLOCKED && pcb->parent->blocked == PROC_BLOCKED_WAIT) {
+                sched_wake(pcb->parent);
+            }
+        } else {
+            proc_free(pcb);                             /* nobody to report to, the stack is not reused before switching */
+        }
+        exception_occurred = 0;
+        schedule();
+    }
+
+    parent = pcb->parent;
+    parent_ebp = pcb->parent_ebp;
+    parent->state = PROC_RUNNING;                       /* takes over the processor right away */
+    parent->blocked = 0;
+    if (terms[pcb->term_id].pid == pcb->pid) {
+        terms[pcb->term_id].pid = parent->pid;
+    }
+    proc_free(pcb);
 
     /* *************** Restore Paging For Parent *************** */
-    page_directories[USER_ENTRY].MB.page_base_address = 2 + pcb->parent->pid;
-    asm volatile (                                      /* flushes the TLB */
-        "movl %%cr3, %%eax\n"
-        "movl %%eax, %%cr3\n"
-        :::"eax"
-    );
+    paging_set_user(parent);
+    fpu_switch(parent);
 
-    tss.esp0 = pcb->parent->esp0;
+    tss.esp0 = parent->esp0;
     tss.ss0 = KERNEL_DS;
 
-    extern uint8_t exception_occurred;
     if (exception_occurred) {
         exception_occurred = 0;                             /* return 256; */
         asm volatile (
             "movl $0x100, %%eax \n"                         /* assignes the return value */
             "movl %0, %%ebp     \n"                         /* set the context to execute() */
             :
-            : "r"(pcb->parent_ebp)
+            : "r"(parent_ebp)
             : "%eax"
         );
     } else {
@@ -124,7 +186,7 @@ int32_t halt(uint8_t status) {
             "movl %0, %%eax\n"                              /* assignes the return value */
             "movl %1, %%ebp\n"                              /* set the context to execute() */
             :
-            : "r"((uint32_t)status), "r"(pcb->parent_ebp)
+            : "r"((uint32_t)status), "r"(parent_ebp)
             : "%eax"
         );
     }
@@ -138,6 +200,17 @@ int32_t halt(uint8_t status) {
     return 0xECE391;
 }
 
+/**
+ * @brief starts the heap of \p pcb empty, right after the last segment
+ * of its program
+ *
+ * @param pcb the process, with its segments set
+ */
+void heap_init(pcb_t *pcb) {
+    pcb->heap_start = PAGE_UP(pcb->elf.segments[pcb->elf.count - 1].end);   /* sorted by address */
+    pcb->heap_end = pcb->heap_start;
+}
+
 /**
  * @brief runs a user program with parameter(s) specified in \p command
  * 
@@ -150,56 +223,47 @@ int32_t execute(const uint8_t *command) {
     }
 
     /* *************** Parse Command *************** */
-    int i = 0;
-    uint8_t file_name[MAX_TERMINAL] = {0};              /* the file name (first part) */
-    uint8_t argument[MAX_TERMINAL] = {0};               /* the added argument (nullable, second) */
-
-    const uint8_t *pos = command;
-    uint8_t *argv_pos;
-    for (; *pos == ' ' && !(i & ~(MAX_TERMINAL - 1)); ++i, ++pos);
-    if (!*pos) {                                        /* skips spaces before command */
-        return -1;                                      /* no command? */
-    }
-    for (argv_pos = file_name; *pos && *pos != ' ' && !(i & ~(MAX_TERMINAL - 1)); ++i, ++pos, ++argv_pos) {
-        *argv_pos = *pos;                               /* parses command */
-    }
-    for (; *pos == ' ' && !(i & ~(MAX_TERMINAL - 1)); ++i, ++pos);  /* skips spaces between command and arguments*/
-    if (*pos) {                                         /* parses arguments if has*/
-        for (argv_pos = argument; *pos && *pos != ' ' && !(i & ~(MAX_TERMINAL - 1)); ++i, ++pos, ++argv_pos) {
-            *argv_pos = *pos;
-        }
-        *argv_pos = 0;
+    int i;
+    uint8_t file_name[MAX_TERMINAL];                    /* the file name (first part) */
+    uint8_t argument[MAX_TERMINAL];                     /* the added argument (nullable, second) */
+    if (parse_command(command, file_name, argument) == -1) {
+        return -1;
     }
 
     cli();
     /* *************** Check Excutability *************** */
-    uint32_t magic;
+    elf_t elf;
     dentry_t den;
     if ((read_dentry_by_name(file_name, &den) == -1)    /* checks the existence of the file */
-        || (read_data(den.inode_num, 0, (uint8_t *)&magic, sizeof(uint32_t)) == -1)
-        || magic != EXECUTABLE_MAGIC) {                 /* checks if the file is executable */
+        || image_elf(den.inode_num, &elf) == -1) {      /* checks if the file is executable */
         return -1;
     }
 
-    /* *************** Check Availablility *************** */
-    for (i = 0; i < MAX_PROCESS && pcbs[i]->present != 0; ++i);
-    if (i == MAX_PROCESS) {                             /* check available pcb address */
+    /* *************** Set Up PCB *************** */
+    pcb_t *pcb = proc_alloc(NULL);
+    if (!pcb) {                                         /* too many processes */
+        return -1;
+    }
+    if (paging_new_user(pcb) == -1) {                   /* out of memory */
+        proc_free(pcb);
         return -1;
     }
-    
-    /* *************** Set Up PCB *************** */
-    int32_t pid = i;
-    pcb_t *pcb = pcbs[pid];
 
-    pcb->present = 1;
-    pcb->pid = pid;
-    pcb->parent = pid < TERMINAL_COUNT ? NULL : get_current_pcb();  /* pid = 0 => terminal */
+    int32_t pid = pcb->pid;
+    pcb->term_id = active_term_id;
+    if (pid >= TERMINAL_COUNT) {                        /* pid < TERMINAL_COUNT => terminal */
+        proc_set_parent(pcb, get_current_pcb());
+        sched_block(PROC_BLOCKED_EXECUTE);              /* the parent runs again as the program halts */
+    }
     asm volatile (
         "movl %%ebp, %0"                                /* records the return address */
         : "=g"(pcb->parent_ebp)
     );
-    pcb->esp0 = KERNEL_STACK - KERNEL_STACK_SIZE * pid;
-    memcpy(pcb->argv, argument, argv_pos - argument + 1);
+    memcpy(pcb->argv, argument, MAX_TERMINAL);
+    pcb->image = image_get(den.inode_num);              /* pages are loaded from it on demand */
+    pcb->inode = den.inode_num;
+    pcb->elf = elf;
+    heap_init(pcb);
     
     pcb->files[0].present = 1;
     pcb->files[0].ops = &stdin_ops;
@@ -211,19 +275,8 @@ int32_t execute(const uint8_t *command) {
     terms[active_term_id].pid = pid;
 
     /* *************** Set Up Paging *************** */
-    page_directories[USER_ENTRY].MB.present = 1;
-    page_directories[USER_ENTRY].MB.user_supervisor = 1;/* user can access the page */
-    page_directories[USER_ENTRY].MB.read_write = 1;     /* user can write the page */
-    page_directories[USER_ENTRY].MB.page_base_address = 2 + pid;
-    asm volatile (                                      /* flushes the TLB */
-        "movl %%cr3, %%eax\n"
-        "movl %%eax, %%cr3\n"
-        :::"eax"
-    );
-
-    uint8_t entry[4];
-    read_data(den.inode_num, 24, (uint8_t *)entry, sizeof(entry));  /* gets the entry */
-    read_data(den.inode_num, 0, (uint8_t *)PROGRAM_IMAGE, PROGRAM_IMAGE_LIMIT);
+    paging_set_user(pcb);                               /* nothing is loaded until touched */
+    fpu_switch(pcb);
 
     tss.esp0 = pcb->esp0;
     tss.ss0 = KERNEL_DS;
@@ -241,16 +294,324 @@ int32_t execute(const uint8_t *command) {
         : "r"((uint32_t)USER_DS),
           "g"((uint32_t)USER_STACK),
           "g"((uint32_t)USER_CS),
-          "r"(((uint32_t)entry[3] << 24)                /* reverses the entry */
-              | ((uint32_t)entry[2] << 16)
-              | ((uint32_t)entry[1] << 8)
-              | ((uint32_t)entry[0]))
+          "r"(elf.entry)
         : "memory"
     );
 
     return 0xECEB3026;                                  /* never reaches here */
 }
 
+/**
+ * @brief duplicates the current process, the pages are shared
+ * copy-on-write until either process writes them
+ * 
+ * @return pid of the child to the parent, 0 to the child, -1 if fail
+ */
+int32_t fork(void) {
+    pcb_t *curr = get_current_pcb(), *pcb;
+
+    cli();
+    if (!(pcb = proc_alloc(curr))) {                    /* too many processes */
+        sti();
+        return -1;
+    }
+    if (paging_new_user(pcb) == -1) {                   /* out of memory */
+        proc_free(pcb);
+        sti();
+        return -1;
+    }
+
+    /* *************** Set Up PCB *************** */
+    pcb->forked = 1;                                    /* halt() does not return to the parent */
+    pcb->term_id = curr->term_id;
+    pcb->priority = curr->priority;                     /* forking does not climb the feedback queue */
+    pcb->vidmap = curr->vidmap;
+    pcb->rtc_rate = curr->rtc_rate;
+    pcb->rtc_curr = curr->rtc_curr;
+    if (curr->rtc) {
+        rtc_attach(pcb);
+    }
+    pcb->image = curr->image;
+    pcb->inode = curr->inode;
+    pcb->elf = curr->elf;
+    pcb->heap_start = curr->heap_start;                 /* the heap pages are shared like the others */
+    pcb->heap_end = curr->heap_end;
+    image_hold(pcb->image);
+    memcpy(pcb->argv, curr->argv, sizeof(pcb->argv));
+    memcpy(pcb->files, curr->files, sizeof(pcb->files));
+    fpu_fork(curr, pcb);
+
+    /* *************** Set Up Paging *************** */
+    paging_fork(curr, pcb);
+    shm_fork(curr, pcb);                                /* shared memory stays shared, not copied */
+    asm volatile (                                      /* flushes the TLB, parent pages are read-only now */
+        "movl %%cr3, %%eax\n"
+        "movl %%eax, %%cr3\n"
+        :::"eax"
+    );
+
+    /* *************** Set Up Kernel Stack *************** */
+    uint32_t *frame = (uint32_t *)(pcb->esp0 - SYSCALL_FRAME_SIZE);
+    memcpy(frame, (uint8_t *)tss.esp0 - SYSCALL_FRAME_SIZE, SYSCALL_FRAME_SIZE);
+    frame[SYSCALL_FRAME_EAX] = 0;                       /* fork() returns 0 to the child */
+    *--frame = (uint32_t)fork_return;                   /* sched_switch() returns into it */
+    *--frame = 0;                                       /* popped as ebp */
+    pcb->ebp = (uint32_t)frame;
+
+    sched_ready(pcb);
+    sti();
+    return pcb->pid;
+}
+
+/**
+ * @brief replaces the program of the current process with the one
+ * specified in \p command, keeping its pid and open files
+ * 
+ * @param command user-input command
+ * @return 0 if success (to the new program), -1 if fail
+ */
+int32_t exec(const uint8_t *command) {
+    pcb_t *curr = get_current_pcb();
+    if (command == NULL) {
+        return -1;
+    }
+
+    uint8_t file_name[MAX_TERMINAL];
+    uint8_t argument[MAX_TERMINAL];
+    if (parse_command(command, file_name, argument) == -1) {
+        return -1;
+    }
+
+    elf_t elf;
+    dentry_t den;
+    if ((read_dentry_by_name(file_name, &den) == -1)    /* checks the existence of the file */
+        || image_elf(den.inode_num, &elf) == -1) {      /* checks if the file is executable */
+        return -1;
+    }
+
+    cli();
+    image_put(curr->image);
+    curr->image = image_get(den.inode_num);
+    curr->inode = den.inode_num;
+    curr->elf = elf;
+    memcpy(curr->argv, argument, MAX_TERMINAL);
+    curr->vidmap = 0;
+    page_table_user_vidmem[VIDMEM_INDEX].present = 0;
+    fpu_release(curr);
+
+    shm_unmap_all(curr);
+    paging_clear_user(curr);                            /* the old program is gone */
+    heap_init(curr);
+    asm volatile (                                      /* flushes the TLB */
+        "movl %%cr3, %%eax\n"
+        "movl %%eax, %%cr3\n"
+        :::"eax"
+    );
+
+    uint32_t *frame = (uint32_t *)(tss.esp0 - SYSCALL_FRAME_SIZE);
+    memset(frame, 0, SYSCALL_FRAME_EAX * sizeof(uint32_t)); /* general registers start cleared */
+    frame[SYSCALL_FRAME_EIP] = elf.entry;               /* returns to the new program */
+    frame[SYSCALL_FRAME_ESP] = USER_STACK;
+    sti();
+    return 0;
+}
+
+/**
+ * @brief waits for a forked child of the current process to halt
+ * 
+ * @param status where the exit status of the child is stored, nullable
+ * @return pid of the child, -1 if there is no forked child
+ */
+int32_t wait(int32_t *status) {
+    int32_t pid, exit_status;
+    pcb_t *curr = get_current_pcb(), *child;
+    if (status && ((uint32_t)status < (USER_ENTRY << 22)
+        || (uint32_t)status > USER_STACK - sizeof(int32_t))) {
+        return -1;                                      /* not in user memory */
+    }
+
+    cli();
+    while (1) {
+        pid = -1;
+        for (child = curr->children; child; child = child->sibling_next) {
+            if (!child->forked) {
+                continue;
+            }
+            pid = child->pid;
+            if (child->state == PROC_ZOMBIE) {
+                exit_status = child->exit_status;
+                proc_free(child);                       /* reaps the child */
+                sti();
+                if (status) {
+                    *status = exit_status;
+                }
+                return pid;
+            }
+        }
+        if (pid == -1) {                                /* no child to wait for */
+            sti();
+            return -1;
+        }
+        sched_block(PROC_BLOCKED_WAIT);                 /* woken by halt() of a child */
+        schedule();
+    }
+}
+
+/**
+ * @brief gives the processor to another ready process, if there is one
+ * 
+ * @return 0
+ */
+int32_t yield(void) {
+    cli();
+    sched_ready(get_current_pcb());                     /* behind the others of its level */
+    schedule();
+    sti();
+    return 0;
+}
+
+/**
+ * @brief blocks the current process for \p ms milliseconds
+ * 
+ * @param ms the time to sleep
+ * @return 0 if success, -1 if \p ms is too long
+ */
+int32_t sleep_ms(uint32_t ms) {
+    if (ms >= SLEEP_MAX_MS) {
+        return -1;
+    }
+    if (!ms) {
+        return yield();
+    }
+    timer_sleep(ms);
+    return 0;
+}
+
+/**
+ * @brief blocks the current process for the interval at \p req,
+ * rounded up to milliseconds
+ * 
+ * @param req the time to sleep
+ * @param rem the time left is stored here, always 0; nullable
+ * @return 0 if success, -1 if the interval is invalid
+ */
+int32_t nanosleep(const timespec_t *req, timespec_t *rem) {
+    if (!req || (uint32_t)req < (USER_ENTRY << 22)
+        || (uint32_t)req > USER_STACK - sizeof(timespec_t)
+        || (rem && ((uint32_t)rem < (USER_ENTRY << 22)
+                    || (uint32_t)rem > USER_STACK - sizeof(timespec_t)))) {
+        return -1;                                      /* not in user memory */
+    }
+    if (req->tv_nsec >= 1000000000 || req->tv_sec >= SLEEP_MAX_MS / 1000) {
+        return -1;
+    }
+
+    if (sleep_ms(req->tv_sec * 1000 + (req->tv_nsec + 999999) / 1000000) == -1) {
+        return -1;
+    }
+    if (rem) {
+        rem->tv_sec = 0;                                /* never interrupted early but by halt */
+        rem->tv_nsec = 0;
+    }
+    return 0;
+}
+
+/**
+ * @brief moves the program break of the current process to \p end;
+ * new heap pages are mapped zeroed on the first touch
+ * 
+ * @param end the new end of the heap
+ * @return 0 if success, -1 if \p end is outside the heap region
+ */
+int32_t brk(void *end) {
+    pcb_t *curr = get_current_pcb();
+    uint32_t new_end = (uint32_t)end, old_page = PAGE_UP(curr->heap_end), new_page;
+    if (new_end < curr->heap_start || new_end > USER_HEAP_LIMIT) {
+        return -1;
+    }
+
+    cli();
+    new_page = PAGE_UP(new_end);
+    if (new_page > old_page) {
+        if (!paging_unused_user(curr, old_page, new_page)) {
+            sti();
+            return -1;                                  /* runs into an anonymous mapping */
+        }
+        paging_reserve_user(curr, old_page, new_page);
+    } else {
+        paging_unmap_user(curr, new_page, old_page);   /* released pages read zero if grown again */
+    }
+    curr->heap_end = new_end;
+    sti();
+    return 0;
+}
+
+/**
+ * @brief moves the program break of the current process by
+ * \p increment bytes
+ * 
+ * @param increment bytes to grow the heap, negative to shrink it
+ * @return the old program break, or -1 if fail
+ */
+void *sbrk(int32_t increment) {
+    uint32_t old_end = get_current_pcb()->heap_end;
+    if ((increment > 0 && old_end + increment < old_end)
+        || brk((void *)(old_end + increment)) == -1) {
+        return (void *)-1;
+    }
+    return (void *)old_end;
+}
+
+/**
+ * @brief maps \p length bytes of anonymous memory to the current
+ * process, below its stack; pages are mapped zeroed on the first touch
+ * 
+ * @param length the size of the mapping, rounded up to pages
+ * @return the start of the mapping, or -1 if there is no room
+ */
+void *mmap(uint32_t length) {
+    pcb_t *curr = get_current_pcb();
+    uint32_t start;
+    if (!length || length > USER_HEAP_LIMIT) {
+        return (void *)-1;
+    }
+    length = PAGE_UP(length);
+
+    cli();
+    if (!(start = paging_find_user(curr, length))) {
+        sti();
+        return (void *)-1;                              /* no room between the heap and the stack */
+    }
+    paging_reserve_user(curr, start, start + length);
+    sti();
+    return (void *)start;
+}
+
+/**
+ * @brief unmaps \p length bytes of anonymous memory at \p addr
+ * 
+ * @param addr the start of the pages, aligned
+ * @param length the size, rounded up to pages
+ * @return 0 if success, -1 if the range is not an anonymous region
+ */
+int32_t munmap(void *addr, uint32_t length) {
+    pcb_t *curr = get_current_pcb();
+    uint32_t start = (uint32_t)addr, end;
+    if ((start & (PAGE_SIZE - 1)) || !length || start < PAGE_UP(curr->heap_start)
+        || start < PAGE_UP(curr->heap_end) || start >= USER_HEAP_LIMIT || length > USER_HEAP_LIMIT - start) {
+        return -1;                                      /* never unmaps the program, heap or stack */
+    }
+    end = start + PAGE_UP(length);                      /* both aligned, still below the stack */
+    if (shm_overlaps(curr, start, end)) {
+        return -1;                                      /* shared memory goes by shm_detach */
+    }
+
+    cli();
+    paging_unmap_user(curr, start, end);
+    sti();
+    return 0;
+}
+
 /**
  * @brief continues to read a file from the position last time, or
  * 0 for the first time
@@ -385,18 +746,9 @@ int32_t vidmap(uint8_t** start) {
     pcb_t *curr = get_current_pcb();
     curr->vidmap = 1;
     page_table_user_vidmem[VIDMEM_INDEX].present = 1;
-    if (active_term_id == shown_term_id) {
-        page_table_user_vidmem[VIDMEM_INDEX].page_base_address = VIDMEM_INDEX;
-    } else {
-        page_table_user_vidmem[VIDMEM_INDEX].page_base_address = VIDMEM_INDEX + curr->pid + 2;
-    }
-    asm volatile (                                      /* flushes the TLB */
-        "movl %%cr3, %%eax\n"                           /* copies the shell's image */
-        "movl %%eax, %%cr3\n"
-        :::"eax"
-    );
+    paging_set_vidmem(curr->term_id);                   /* drops the stale entry with invlpg */
 
-    *start = (uint8_t *)(((VIDMEM_INDEX << 22) | (VIDMEM_INDEX << 12)) & 0xFFFFF000) ;
+    *start = (uint8_t *)USER_VIDMEM_ADDR;
     return 0;
 }
 
@@ -465,17 +817,19 @@ int32_t delete(const uint8_t *file_name) {
         return -1;
     }
 
-    for (i = TERMINAL_COUNT; i < MAX_PROCESS; ++i) {                /* some processes are using this file */
+    pcb_t *pcb = proc_list;
+    do {                                                            /* some processes are using this file */
         for (j = 2; j < 8; ++j) {
-            if (pcbs[i]->files[j].present && pcbs[i]->files[j].inode == den.inode_num) {
+            if (pcb->files[j].present && pcb->files[j].inode == den.inode_num) {
                 printf("File is openning in other process(es)!\n");
                 return -1;
             }
         }
-    }
+    } while ((pcb = pcb->next) != proc_list);
 
     /* clears data from data blocks, and marks them as free */
     inode_t *in = inode_blocks + den.inode_num;
+    image_invalidate(den.inode_num);                                /* drops the cached program */
     for (i = 0; in->data_blocks[i] != 0 && i < boot_block->inode_count; ++i) {
         memset(data_blocks[in->data_blocks[i]].data, 0, FS_BLOCK_SIZE);
         data_block_bitmap[i] = 0;
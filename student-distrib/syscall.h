@@ -6,18 +6,45 @@
 #include "lib.h"
 
 #define EXECUTABLE_MAGIC        0x464C457F          /* the first four bytes of executable files */
-#define MAX_PROCESS             6                   /* 1 terminal and 2 user applications */
+#define MAX_PROCESS             1024                /* size of the process table */
 
-#define KERNEL_STACK            0x800000
-#define KERNEL_STACK_SIZE       0x2000
-
-#define PROGRAM_IMAGE           0x08048000          /* user-level destination of user program */
-#define PROGRAM_IMAGE_LIMIT     0x3B8000            /* page end of user's page entry */
+#define KERNEL_STACK_SIZE       0x2000              /* each holds its pcb at the bottom */
 
 #define USER_ENTRY              (0x8000000 >> 22)   /* user's page directory entry */
 #define USER_STACK              0x8400000           /* starting address of user entry */
+#define USER_STACK_SIZE         0x100000            /* the stack is mapped on demand down to here */
+#define USER_HEAP_LIMIT         (USER_STACK - USER_STACK_SIZE)  /* the heap and mmap regions end here */
+
+#define PROC_RUNNING            0                   /* on the processor */
+#define PROC_READY              1                   /* in the run queue */
+#define PROC_BLOCKED            2                   /* waits for an event, not scheduled */
+#define PROC_ZOMBIE             3                   /* halted forked process, until its parent waits for it */
+
+#define PROC_BLOCKED_EXECUTE    1                   /* parent waits for the program it executed */
+#define PROC_BLOCKED_WAIT       2                   /* parent waits for a forked child in wait() */
+#define PROC_BLOCKED_QUEUE      3                   /* sleeps on a wait queue */
+#define PROC_BLOCKED_SLEEP      4                   /* sleeps on the timer queue */
 
-extern pcb_t *pcbs[MAX_PROCESS];
+#define SLEEP_MAX_MS            0x40000000          /* deadlines are compared by signed difference */
+
+#define SYSCALL_FRAME_SIZE      60                  /* saved registers and iret frame atop the kernel stack */
+#define SYSCALL_FRAME_EAX       6                   /* dword indices into that frame */
+#define SYSCALL_FRAME_EIP       10
+#define SYSCALL_FRAME_ESP       13
+
+/**
+ * @brief where a forked child starts, returns to user mode through the
+ * copied system call frame (linkage.S)
+ */
+extern void fork_return();
+
+/**
+ * @brief starts the heap of \p pcb empty, right after the last segment
+ * of its program
+ *
+ * @param pcb the process, with its segments set
+ */
+extern void heap_init(pcb_t *pcb);
 
 /**
  * @brief terminates the currently executing user program, with exit code \p status
@@ -114,29 +141,98 @@ extern int32_t create(const uint8_t *file_name);
 extern int32_t delete(const uint8_t *file_name);
 
 /**
- * @brief allocates a block of runtime memory with size \p size
+ * @brief creates a copy of the current process, whose user pages are
+ * shared copy-on-write with the parent
+ * 
+ * @return pid of the child to the parent, 0 to the child, -1 if fail
+ */
+extern int32_t fork(void);
+
+/**
+ * @brief replaces the program of the current process with the one
+ * specified in \p command, keeping its pid and open files
+ * 
+ * @param command user-input command
+ * @return does not return if success, -1 if fail
+ */
+extern int32_t exec(const uint8_t *command);
+
+/**
+ * @brief waits for a forked child to halt and reclaims it
+ * 
+ * @param status where the exit status of the child is stored, nullable
+ * @return pid of the halted child, or -1 if there is no child
+ */
+extern int32_t wait(int32_t *status);
+
+/**
+ * @brief \c timespec_t is a time interval for \c nanosleep
+ */
+typedef struct timespec_t {
+    uint32_t tv_sec;
+    uint32_t tv_nsec;           /* below 1000000000 */
+} timespec_t;
+
+/**
+ * @brief gives the processor to another ready process, if there is one
+ * 
+ * @return 0
+ */
+extern int32_t yield(void);
+
+/**
+ * @brief blocks the current process for \p ms milliseconds
+ * 
+ * @param ms the time to sleep
+ * @return 0 if success, -1 if \p ms is too long
+ */
+extern int32_t sleep_ms(uint32_t ms);
+
+/**
+ * @brief blocks the current process for the interval at \p req,
+ * rounded up to milliseconds
+ * 
+ * @param req the time to sleep
+ * @param rem the time left is stored here, always 0; nullable
+ * @return 0 if success, -1 if the interval is invalid
+ */
+extern int32_t nanosleep(const timespec_t *req, timespec_t *rem);
+
+/**
+ * @brief moves the program break of the current process to \p end;
+ * new heap pages are mapped zeroed on the first touch
+ * 
+ * @param end the new end of the heap
+ * @return 0 if success, -1 if \p end is outside the heap region
+ */
+extern int32_t brk(void *end);
+
+/**
+ * @brief moves the program break of the current process by
+ * \p increment bytes
  * 
- * @param size size of memory in byte
- * @return allocated memory
+ * @param increment bytes to grow the heap, negative to shrink it
+ * @return the old program break, or -1 if fail
  */
-extern void *malloc(uint32_t size);
+extern void *sbrk(int32_t increment);
 
 /**
- * @brief enlarges the allocated memory starting at \p src with new
- * size \p size
+ * @brief maps \p length bytes of anonymous memory to the current
+ * process, below its stack; pages are mapped zeroed on the first touch
  * 
- * @param src starting address of memory
- * @param size new size of memory in byte
- * @return allocated memory
+ * @param length the size of the mapping, rounded up to pages
+ * @return the start of the mapping, or -1 if there is no room
  */
-extern void *realloc(void *src, uint32_t size);
+extern void *mmap(uint32_t length);
 
 /**
- * @brief releases the ownership of the memory starting at \p src
+ * @brief unmaps \p length bytes of anonymous memory at \p addr
  * 
- * @param src starting address of memory
+ * @param addr the start of the pages, aligned
+ * @param length the size, rounded up to pages
+ * @return 0 if success, -1 if the range is not an anonymous region
  */
-extern void free(void *src);
+extern int32_t munmap(void *addr, uint32_t length);
 
 #endif
 
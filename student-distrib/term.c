@@ -1,6 +1,7 @@
 #include "term.h"
 
 #include "x86_desc.h"
+#include "sched.h"
 
 /**
  * @brief opens the terminal (does nothing)
@@ -35,8 +36,12 @@ int32_t terminal_read(int32_t file, void* buf, uint32_t count) {
         return -1;
     }
 
+    cli();
     terms[active_term_id].input.in_progress = 1;            /* starts recording and waiting */
-    while (terms[active_term_id].input.in_progress);
+    while (terms[active_term_id].input.in_progress && !terms[active_term_id].input.to_be_halt) {
+        wait_queue_sleep(&terms[active_term_id].input.readers); /* woken by enter or ctrl + C */
+    }
+    sti();
 
                                                             /* checked length in keyboard handler */
     if (count > terms[active_term_id].input.length) {       /* set null-termination of string */
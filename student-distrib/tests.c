@@ -6,6 +6,13 @@
 #include "filesys.h"
 #include "syscall.h"
 #include "malloc.h"
+#include "image.h"
+#include "buddy.h"
+#include "frame.h"
+#include "proc.h"
+#include "paging.h"
+#include "shm.h"
+#include "swap.h"
 
 #define PASS 1
 #define FAIL 0
@@ -148,6 +155,356 @@ int list_file_test() {
 /* Checkpoint 4 tests */
 /* Checkpoint 5 tests */
 
+/* Extra feature tests */
+int image_cache_test() {
+	TEST_HEADER;
+	dentry_t den;
+	image_t *first, *second;
+	if (read_dentry_by_name((const uint8_t *)"shell", &den) == -1) {
+		return FAIL;
+	}
+	/* non-executables are never cached */
+	if (read_dentry_by_name((const uint8_t *)"frame0.txt", &den) == -1
+		|| image_get(den.inode_num) != NULL) {
+		return FAIL;
+	}
+
+	read_dentry_by_name((const uint8_t *)"shell", &den);
+	first = image_get(den.inode_num);
+	second = image_get(den.inode_num);		/* the second lookup hits the first copy */
+	if (!first || first != second || first->refs != 2) {
+		return FAIL;
+	}
+	image_put(second);
+
+	image_invalidate(den.inode_num);		/* still referenced: kept until released */
+	second = image_get(den.inode_num);
+	if (!second || second == first || !first->stale) {
+		return FAIL;
+	}
+	image_put(first);
+	image_put(second);
+	return first->present ? FAIL : PASS;
+}
+
+int elf_test() {
+	TEST_HEADER;
+	dentry_t den;
+	elf_t elf;
+	if (read_dentry_by_name((const uint8_t *)"frame0.txt", &den) == -1
+		|| elf_parse(den.inode_num, &elf) != -1) {	/* not an executable */
+		return FAIL;
+	}
+	if (read_dentry_by_name((const uint8_t *)"hello", &den) == -1
+		|| elf_parse(den.inode_num, &elf) == -1 || elf.count != 2) {
+		return FAIL;
+	}
+	/* code first and read-only, data after it and writable, read from the flat layout */
+	if (elf.segments[0].writable || !elf.segments[1].writable
+		|| elf.entry < elf.segments[0].start || elf.entry >= elf.segments[0].end
+		|| elf.segments[1].offset != elf.segments[1].start - elf.segments[0].start) {
+		return FAIL;
+	}
+	return PASS;
+}
+
+int frame_test() {
+	TEST_HEADER;
+	uint32_t free = frame_free_count();
+	uint32_t first = frame_alloc(), second = frame_alloc();
+	if (!first || !second || first == second || frame_free_count() != free - 2) {
+		return FAIL;
+	}
+	*(uint32_t *)first = 391;				/* the pool is identity mapped */
+
+	frame_hold(first);						/* shared: the first release keeps it */
+	frame_put(first);
+	if (frame_refs(first) != 1 || frame_free_count() != free - 2) {
+		return FAIL;
+	}
+	frame_put(first);
+	frame_put(second);
+	if (frame_refs(first) || frame_free_count() != free) {
+		return FAIL;
+	}
+	first = frame_alloc();					/* freed frames merge back */
+	frame_put(first);
+	return frame_free_count() == free ? PASS : FAIL;
+}
+
+int buddy_test() {
+	TEST_HEADER;
+	uint32_t order, free = buddy_free_pages(), blocks[BUDDY_MAX_ORDER + 1];
+	uint8_t *small, *large;
+	for (order = 0; order <= BUDDY_MAX_ORDER; ++order) {
+		blocks[order] = buddy_free_blocks(order);
+	}
+
+	small = get_free_pages(0);
+	large = get_free_pages(3);
+	if (!small || !large || ((uint32_t)large & ((BUDDY_PAGE_SIZE << 3) - 1))
+		|| (uint32_t)small < BUDDY_START || buddy_free_pages() != free - 1 - 8) {
+		return FAIL;
+	}
+	large[(BUDDY_PAGE_SIZE << 3) - 1] = 0x91;	/* the block is identity mapped */
+	if (get_free_pages(BUDDY_MAX_ORDER + 1)) {
+		return FAIL;
+	}
+
+	free_pages(large, 3);
+	free_pages(small, 0);					/* buddies merge back to the same blocks */
+	for (order = 0; order <= BUDDY_MAX_ORDER; ++order) {
+		if (buddy_free_blocks(order) != blocks[order]) {
+			return FAIL;
+		}
+	}
+	return buddy_free_pages() == free ? PASS : FAIL;
+}
+
+int memory_size_test() {
+	TEST_HEADER;
+	uint32_t total = buddy_total_pages(), limit = (total + swap_total_pages()) / PROC_MIN_PAGES;
+	if (!total || buddy_free_pages() > total
+		|| buddy_end() < BUDDY_START + total * BUDDY_PAGE_SIZE || buddy_end() > BUDDY_LIMIT) {
+		return FAIL;
+	}
+	return proc_limit() == (limit < MAX_PROCESS ? limit : MAX_PROCESS) ? PASS : FAIL;	/* scales with memory */
+}
+
+int kmalloc_test() {
+	TEST_HEADER;
+	uint32_t free;
+	uint8_t *first = kmalloc(100), *second = kmalloc(100), *large;
+	if (!first || !second || first == second
+		|| ((uint32_t)first & 127) || ((uint32_t)second & 127)) {	/* from the 128-byte class */
+		return FAIL;
+	}
+	kfree(first);
+	if (kmalloc(128) != first) {			/* the freed object is reused first */
+		return FAIL;
+	}
+	kfree(first);
+	kfree(second);
+
+	free = buddy_free_pages();
+	large = kmalloc(5000);					/* two pages of the heap, not backed yet */
+	if (!large || ((uint32_t)large & (BUDDY_PAGE_SIZE - 1)) || buddy_free_pages() != free) {
+		return FAIL;
+	}
+	if (large[4999] || buddy_free_pages() != free - 1) {	/* zeroed as it is touched */
+		return FAIL;
+	}
+	kfree(large);
+	return buddy_free_pages() == free && !kmalloc(0) ? PASS : FAIL;
+}
+
+static void kmem_cache_test_ctor(void *obj) {
+	*(uint32_t *)obj = 391;
+}
+
+int kmem_cache_test() {
+	TEST_HEADER;
+	kmem_cache_t *cache = kmem_cache_create((const int8_t *)"test", 100, 0, kmem_cache_test_ctor);
+	uint32_t *first, *second;
+	if (!cache || cache->size != 128) {		/* rounded to whole cache lines */
+		return FAIL;
+	}
+	first = kmem_cache_alloc(cache);
+	second = kmem_cache_alloc(cache);
+	if (!first || !second || ((uint32_t)first & (CACHE_LINE_SIZE - 1))
+		|| *first != 391 || *second != 391 || cache->in_use != 2 || cache->slabs != 1) {
+		return FAIL;
+	}
+	kmem_cache_free(cache, second);			/* freed in the constructed state */
+	if (kmem_cache_alloc(cache) != second || *second != 391) {
+		return FAIL;
+	}
+	kmem_cache_free(cache, first);
+	kmem_cache_free(cache, second);
+	if (cache->in_use || cache->free_count != cache->per_slab) {
+		return FAIL;
+	}
+	cache = kmem_cache_create((const int8_t *)"large", 0x2000, 0x2000, NULL);
+	if (!cache || !cache->off_slab || !(first = kmem_cache_alloc(cache))
+		|| ((uint32_t)first & 0x1FFF) || cache->per_slab != (0x1000 << cache->order) / 0x2000) {
+		return FAIL;						/* the header takes no object */
+	}
+	kmem_cache_free(cache, first);
+	return !cache->in_use ? PASS : FAIL;
+}
+
+int proc_test() {
+	TEST_HEADER;
+	pcb_t *parent = proc_alloc(NULL), *child = proc_alloc(parent), *again;
+	if (!parent || !child || child->pid != parent->pid + 1
+		|| proc_get(child->pid) != child || parent->children != child
+		|| child->esp0 != (uint32_t)child + KERNEL_STACK_SIZE) {
+		return FAIL;
+	}
+
+	parent->files[3].present = 1;
+	proc_free(parent);						/* the child is orphaned */
+	if (child->parent || proc_get(parent->pid)) {
+		return FAIL;
+	}
+	again = proc_alloc(NULL);				/* the lowest pid and the last stack come back */
+	if (again != parent || again->pid != parent->pid || again->files[3].present
+		|| again->esp0 != (uint32_t)again + KERNEL_STACK_SIZE) {
+		return FAIL;
+	}
+	proc_free(again);
+	proc_free(child);
+	return proc_list ? FAIL : PASS;
+}
+
+int address_space_test() {
+	TEST_HEADER;
+	pcb_t *pcb = proc_alloc(NULL);
+	uint32_t free = frame_free_count(), directory, cr3;
+	if (!pcb || paging_new_user(pcb) == -1) {
+		return FAIL;
+	}
+	directory = (uint32_t)pcb->page_directory;
+	if (pcb->page_directory[1].val != page_directories[1].val		/* kernel pages are shared */
+		|| !pcb->page_directory[1].MB.global
+		|| pcb->page_directory[USER_ENTRY].KB.page_table_base_address != (uint32_t)pcb->page_table >> 12) {
+		return FAIL;
+	}
+
+	paging_set_user(pcb);
+	asm volatile ("movl %%cr3, %0" : "=r"(cr3));
+	if (cr3 != directory) {
+		return FAIL;
+	}
+	paging_free_user(pcb);					/* leaves the directory before releasing it */
+	asm volatile ("movl %%cr3, %0" : "=r"(cr3));
+	proc_free(pcb);
+	return cr3 == (uint32_t)page_directories && frame_free_count() == free ? PASS : FAIL;
+}
+
+int user_heap_test() {
+	TEST_HEADER;
+	pcb_t *pcb = proc_alloc(NULL);
+	uint32_t free, start = USER_HEAP_LIMIT - 2 * 0x1000;
+	if (!pcb || paging_new_user(pcb) == -1 || !paging_unused_user(pcb, start, USER_HEAP_LIMIT)) {
+		return FAIL;
+	}
+	free = frame_free_count();
+	paging_reserve_user(pcb, start, USER_HEAP_LIMIT);
+	if (paging_unused_user(pcb, start, USER_HEAP_LIMIT) || frame_free_count() != free) {
+		return FAIL;						/* reserved, but no frame until touched */
+	}
+	paging_unmap_user(pcb, start, USER_HEAP_LIMIT);
+	if (!paging_unused_user(pcb, start, USER_HEAP_LIMIT)) {
+		return FAIL;
+	}
+	paging_free_user(pcb);
+	proc_free(pcb);
+	return frame_free_count() == free + 2 ? PASS : FAIL;	/* the directory and table are back */
+}
+
+int shm_test() {
+	TEST_HEADER;
+	pcb_t *a = proc_alloc(NULL), *b = proc_alloc(NULL);
+	uint32_t free, addr_a, addr_b;
+	int32_t id;
+	if (!a || !b || paging_new_user(a) == -1 || paging_new_user(b) == -1) {
+		return FAIL;
+	}
+	free = frame_free_count();
+	if ((id = shm_create(0x391, 2 * 0x1000)) == -1 || shm_create(0x391, 0x1000) != id
+		|| shm_create(0x391, 3 * 0x1000) != -1 || frame_free_count() != free - 2) {
+		return FAIL;						/* the key finds the same segment */
+	}
+	if (!(addr_a = shm_map(a, id)) || !(addr_b = shm_map(b, id))
+		|| a->page_table[(addr_a >> 12) & 0x3FF].page_base_address
+		   != b->page_table[(addr_b >> 12) & 0x3FF].page_base_address
+		|| !shm_overlaps(a, addr_a, addr_a + 0x1000)) {
+		return FAIL;
+	}
+	if (shm_unmap(a, addr_a) == -1 || shm_unmap(a, addr_a) != -1
+		|| frame_free_count() != free - 2) {
+		return FAIL;						/* b still has it attached */
+	}
+	shm_unmap_all(b);
+	if (frame_free_count() != free) {
+		return FAIL;
+	}
+	paging_free_user(a);
+	paging_free_user(b);
+	proc_free(a);
+	proc_free(b);
+	return PASS;
+}
+
+int swap_test() {
+	TEST_HEADER;
+	pcb_t *pcb = proc_alloc(NULL), *child = proc_alloc(NULL);
+	uint32_t i, frame, free, used = swap_used_pages();
+	pte_t *pte;
+	if (!swap_total_pages()) {
+		return PASS;						/* no swap drive attached */
+	}
+	if (!pcb || !child || paging_new_user(pcb) == -1 || paging_new_user(child) == -1
+		|| !(frame = frame_alloc())) {
+		return FAIL;
+	}
+	for (i = 0; i < 0x1000; ++i) {
+		((uint8_t *)frame)[i] = (uint8_t)i;
+	}
+	pte = pcb->page_table + 5;				/* a private, untouched page */
+	pte->val = 0;
+	pte->page_base_address = frame >> 12;
+	pte->user_supervisor = 1;
+	pte->read_write = 1;
+	pte->present = 1;
+	free = frame_free_count();
+	while (pte->present && swap_reclaim(1));
+	if (pte->present || !(pte->available & PTE_SWAPPED) || !pte->read_write
+		|| swap_used_pages() <= used || frame_free_count() <= free) {
+		return FAIL;
+	}
+	paging_fork(pcb, child);				/* both entries share the slot */
+	if (swap_in(pte) == -1 || !pte->present || child->page_table[5].present) {
+		return FAIL;
+	}
+	frame = pte->page_base_address << 12;
+	for (i = 0; i < 0x1000; ++i) {
+		if (((uint8_t *)frame)[i] != (uint8_t)i) {
+			return FAIL;
+		}
+	}
+	paging_free_user(pcb);
+	paging_free_user(child);
+	proc_free(pcb);
+	proc_free(child);
+	return swap_used_pages() == used ? PASS : FAIL;
+}
+
+int zero_pool_test() {
+	TEST_HEADER;
+	uint32_t i, free, addr;
+	while (frame_zero_wanted()) {
+		frame_zero_one();					/* as the idle task does */
+	}
+	free = frame_free_count();
+	if (!(addr = frame_alloc())) {
+		return FAIL;
+	}
+	memset((void *)addr, 0xFF, FRAME_SIZE);
+	frame_put(addr);						/* a dirty frame is back in the buddy allocator */
+	if (!(addr = frame_alloc_zeroed()) || frame_free_count() != free - 1 || frame_refs(addr) != 1) {
+		return FAIL;
+	}
+	for (i = 0; i < FRAME_SIZE; ++i) {
+		if (((uint8_t *)addr)[i]) {
+			return FAIL;
+		}
+	}
+	frame_put(addr);
+	return frame_free_count() == free ? PASS : FAIL;
+}
+
 
 /* Test suite entry point */
 void launch_tests(){
@@ -162,6 +519,19 @@ void launch_tests(){
 	// TEST_OUTPUT("file_system_test", file_system_test());
 	// TEST_OUTPUT("list_file_test", list_file_test());
 	// TEST_OUTPUT("terminal_test", terminal_test());
+	// TEST_OUTPUT("image_cache_test", image_cache_test());
+	// TEST_OUTPUT("elf_test", elf_test());
+	// TEST_OUTPUT("frame_test", frame_test());
+	// TEST_OUTPUT("buddy_test", buddy_test());
+	// TEST_OUTPUT("memory_size_test", memory_size_test());
+	// TEST_OUTPUT("kmalloc_test", kmalloc_test());
+	TEST_OUTPUT("kmem_cache_test", kmem_cache_test());
+	// TEST_OUTPUT("proc_test", proc_test());
+	// TEST_OUTPUT("address_space_test", address_space_test());
+	// TEST_OUTPUT("user_heap_test", user_heap_test());
+	// TEST_OUTPUT("shm_test", shm_test());
+	// TEST_OUTPUT("swap_test", swap_test());
+	// TEST_OUTPUT("zero_pool_test", zero_pool_test());
 	
 	// execute((const uint8_t *)"               shell    ");
 
@@ -102,3 +102,239 @@ uint8_t* ece391_strrev(uint8_t* s)
    return s;
 }
 
+
+/*
+ * The heap allocator. Blocks up to 2 KB come from the free list of
+ * their power-of-two size class, carved from whole pages; larger blocks
+ * are runs of pages, merged with free neighbours as they are freed.
+ * Pages come from ece391_sbrk and a free run at the top of the heap is
+ * given back, so the kernel is entered only as the heap grows or
+ * shrinks.
+ */
+#if !defined(NULL)
+#define NULL                0
+#endif
+
+#define HEAP_PAGE_SIZE      4096
+#define HEAP_PAGE_COUNT     1024            /* pages of the 4 MB user memory */
+#define HEAP_MIN_SHIFT      4               /* the smallest class holds 16 bytes */
+#define HEAP_MAX_SHIFT      11              /* the largest class holds 2 KB */
+#define HEAP_CLASSES        (HEAP_MAX_SHIFT - HEAP_MIN_SHIFT + 1)
+
+#define SPAN_USED           0xFF            /* first page of an allocated run */
+#define SPAN_FREE           0xFE            /* first and last page of a free run */
+#define SPAN_TAIL           0xFD            /* last page of an allocated run */
+                                            /* 1 to HEAP_CLASSES: a page of objects of class - 1 */
+
+#define HEAP_INDEX(addr)    (((uint32_t)(addr) / HEAP_PAGE_SIZE) % HEAP_PAGE_COUNT)
+#define HEAP_PAGES(size)    (((size) + HEAP_PAGE_SIZE - 1) / HEAP_PAGE_SIZE)
+
+static uint8_t span_kind[HEAP_PAGE_COUNT];
+static uint16_t span_pages[HEAP_PAGE_COUNT];    /* pages of the run, at its first and last page */
+static void* class_free[HEAP_CLASSES];          /* free objects of each class, each holding the next */
+static uint32_t heap_base = 0;                  /* the first page of the heap, 0 before the first use */
+static uint32_t heap_top = 0;                   /* end of the pages taken from the kernel */
+
+/* Mark the run of "pages" pages at "addr" free */
+static void heap_set_free(uint32_t addr, uint32_t pages)
+{
+    span_kind[HEAP_INDEX(addr)] = SPAN_FREE;
+    span_pages[HEAP_INDEX(addr)] = pages;
+    span_kind[HEAP_INDEX(addr) + pages - 1] = SPAN_FREE;
+    span_pages[HEAP_INDEX(addr) + pages - 1] = pages;
+}
+
+/* Mark the run of "pages" pages at "addr" allocated */
+static void heap_set_used(uint32_t addr, uint32_t pages)
+{
+    if (pages > 1) {
+        span_kind[HEAP_INDEX(addr) + pages - 1] = SPAN_TAIL;
+    }
+    span_kind[HEAP_INDEX(addr)] = SPAN_USED;
+    span_pages[HEAP_INDEX(addr)] = pages;
+}
+
+/* Align the program break to a page and start the heap there */
+static int32_t heap_init(void)
+{
+    uint32_t brk = (uint32_t)ece391_sbrk(0);
+
+    if (brk == (uint32_t)-1 ||
+        (brk % HEAP_PAGE_SIZE && ece391_sbrk(HEAP_PAGE_SIZE - brk % HEAP_PAGE_SIZE) == (void*)-1)) {
+        return -1;
+    }
+    heap_base = heap_top = HEAP_PAGES(brk) * HEAP_PAGE_SIZE;
+    return 0;
+}
+
+/* Ask the kernel for "pages" more pages at the top of the heap */
+static int32_t heap_grow(uint32_t pages)
+{
+    if (ece391_sbrk(pages * HEAP_PAGE_SIZE) == (void*)-1) {
+        return -1;
+    }
+    heap_top += pages * HEAP_PAGE_SIZE;
+    return 0;
+}
+
+/* Take a run of "pages" pages, the first that fits, or grow the heap */
+static uint32_t heap_take(uint32_t pages)
+{
+    uint32_t addr, have;
+
+    if (0 == heap_base && heap_init() == -1) {
+        return 0;
+    }
+    for (addr = heap_base; addr < heap_top; addr += span_pages[HEAP_INDEX(addr)] * HEAP_PAGE_SIZE) {
+        have = span_pages[HEAP_INDEX(addr)];
+        if (span_kind[HEAP_INDEX(addr)] == SPAN_FREE && have >= pages) {
+            if (have > pages) {
+                heap_set_free(addr + pages * HEAP_PAGE_SIZE, have - pages);
+            }
+            heap_set_used(addr, pages);
+            return addr;
+        }
+    }
+
+    /* A free run at the top only needs the rest */
+    addr = heap_top;
+    if (heap_top > heap_base && span_kind[HEAP_INDEX(heap_top) - 1] == SPAN_FREE) {
+        addr -= span_pages[HEAP_INDEX(heap_top) - 1] * HEAP_PAGE_SIZE;
+    }
+    if (heap_grow(pages - (heap_top - addr) / HEAP_PAGE_SIZE) == -1) {
+        return 0;
+    }
+    heap_set_used(addr, pages);
+    return addr;
+}
+
+/* Free the run of "pages" pages at "addr", merging it with free neighbours */
+static void heap_give(uint32_t addr, uint32_t pages)
+{
+    uint32_t next = addr + pages * HEAP_PAGE_SIZE;
+
+    if (next < heap_top && span_kind[HEAP_INDEX(next)] == SPAN_FREE) {
+        pages += span_pages[HEAP_INDEX(next)];
+    }
+    if (addr > heap_base && span_kind[HEAP_INDEX(addr) - 1] == SPAN_FREE) {
+        addr -= span_pages[HEAP_INDEX(addr) - 1] * HEAP_PAGE_SIZE;
+        pages += span_pages[HEAP_INDEX(addr)];
+    }
+
+    if (addr + pages * HEAP_PAGE_SIZE == heap_top &&
+        ece391_sbrk(-(int32_t)(pages * HEAP_PAGE_SIZE)) != (void*)-1) {
+        heap_top = addr;                    /* the kernel takes the frames back */
+        return;
+    }
+    heap_set_free(addr, pages);
+}
+
+/* Allocate "size" bytes, NULL if out of memory */
+void* ece391_malloc(uint32_t size)
+{
+    uint32_t class, object, page;
+    uint8_t* obj;
+
+    if (0 == size || size > HEAP_PAGE_COUNT * HEAP_PAGE_SIZE) {
+        return NULL;
+    }
+    if (size > (1 << HEAP_MAX_SHIFT)) {
+        return (void*)heap_take(HEAP_PAGES(size));
+    }
+
+    for (class = 0; (1U << (HEAP_MIN_SHIFT + class)) < size; class++);
+    if (NULL == class_free[class]) {
+        /* Carve a page into objects, lowest handed out first */
+        if (0 == (page = heap_take(1))) {
+            return NULL;
+        }
+        span_kind[HEAP_INDEX(page)] = class + 1;
+        object = 1 << (HEAP_MIN_SHIFT + class);
+        for (obj = (uint8_t*)page + HEAP_PAGE_SIZE - object; obj >= (uint8_t*)page; obj -= object) {
+            *(void**)obj = class_free[class];
+            class_free[class] = obj;
+        }
+    }
+    obj = class_free[class];
+    class_free[class] = *(void**)obj;
+    return obj;
+}
+
+/* Release a block from ece391_malloc, NULL is ignored */
+void ece391_free(void* ptr)
+{
+    uint32_t kind;
+
+    if (NULL == ptr) {
+        return;
+    }
+    kind = span_kind[HEAP_INDEX(ptr)];
+    if (kind >= 1 && kind <= HEAP_CLASSES) {
+        *(void**)ptr = class_free[kind - 1];
+        class_free[kind - 1] = ptr;
+    } else if (kind == SPAN_USED) {
+        heap_give((uint32_t)ptr, span_pages[HEAP_INDEX(ptr)]);
+    }
+}
+
+/* Resize a block to "size" bytes, in place where the neighbours allow */
+void* ece391_realloc(void* ptr, uint32_t size)
+{
+    uint32_t kind, old_size, pages, want, next;
+    uint8_t* block;
+    uint8_t* dst;
+    uint8_t* src;
+
+    if (NULL == ptr) {
+        return ece391_malloc(size);
+    }
+    if (0 == size) {
+        ece391_free(ptr);
+        return NULL;
+    }
+
+    kind = span_kind[HEAP_INDEX(ptr)];
+    if (kind >= 1 && kind <= HEAP_CLASSES) {
+        old_size = 1 << (HEAP_MIN_SHIFT + kind - 1);
+        if (size <= old_size) {
+            return ptr;                     /* still fits its class */
+        }
+    } else if (kind == SPAN_USED) {
+        pages = span_pages[HEAP_INDEX(ptr)];
+        old_size = pages * HEAP_PAGE_SIZE;
+        want = HEAP_PAGES(size);
+        next = (uint32_t)ptr + old_size;
+        if (want < pages) {
+            heap_set_used((uint32_t)ptr, want);     /* gives the tail back */
+            heap_give((uint32_t)ptr + want * HEAP_PAGE_SIZE, pages - want);
+            return ptr;
+        }
+        if (want == pages) {
+            return ptr;
+        }
+        if (want > pages && next < heap_top && span_kind[HEAP_INDEX(next)] == SPAN_FREE &&
+            span_pages[HEAP_INDEX(next)] >= want - pages) {
+            if (span_pages[HEAP_INDEX(next)] > want - pages) {
+                heap_set_free((uint32_t)ptr + want * HEAP_PAGE_SIZE,
+                              span_pages[HEAP_INDEX(next)] - (want - pages));
+            }
+            heap_set_used((uint32_t)ptr, want);     /* takes the free run after it */
+            return ptr;
+        }
+        if (want > pages && next == heap_top && heap_grow(want - pages) == 0) {
+            heap_set_used((uint32_t)ptr, want);     /* the top of the heap grows */
+            return ptr;
+        }
+    } else {
+        return NULL;                        /* not from ece391_malloc */
+    }
+
+    if (NULL == (block = ece391_malloc(size))) {
+        return NULL;
+    }
+    for (dst = block, src = ptr; old_size && size; old_size--, size--) {
+        *dst++ = *src++;
+    }
+    ece391_free(ptr);
+    return block;
+}
@@ -9,5 +9,10 @@ extern int32_t ece391_strncmp(const uint8_t* s1, const uint8_t* s2, uint32_t n);
 extern uint8_t *ece391_itoa(uint32_t value, uint8_t* buf, int32_t radix);
 extern uint8_t *ece391_strrev(uint8_t* s);
 
+/* The heap: blocks are not cleared, NULL is returned when out of memory */
+extern void* ece391_malloc(uint32_t size);
+extern void ece391_free(void* ptr);
+extern void* ece391_realloc(void* ptr, uint32_t size);
+
 #endif /* ECE391SUPPORT_H */
 
@@ -23,6 +23,30 @@ extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
 extern int32_t ece391_create (const uint8_t *file_name);
 extern int32_t ece391_delete (const uint8_t *file_name);
+extern int32_t ece391_fork (void);
+extern int32_t ece391_exec (const uint8_t* command);
+extern int32_t ece391_wait (int32_t* status);
+
+/* tv_nsec must be below 1000000000; sleeps are rounded up to milliseconds */
+typedef struct ece391_timespec {
+    uint32_t tv_sec;
+    uint32_t tv_nsec;
+} ece391_timespec;
+
+extern int32_t ece391_yield (void);
+extern int32_t ece391_sleep_ms (uint32_t ms);
+extern int32_t ece391_nanosleep (const ece391_timespec* req, ece391_timespec* rem);
+
+/* heap pages read zero until written; sbrk and mmap return (void*)-1 on failure */
+extern int32_t ece391_brk (void* end);
+extern void* ece391_sbrk (int32_t increment);
+extern void* ece391_mmap (uint32_t length);
+extern int32_t ece391_munmap (void* addr, uint32_t length);
+
+/* segments with the same key are shared by every process attaching them; shm_attach returns (void*)-1 on failure */
+extern int32_t ece391_shm_create (uint32_t key, uint32_t size);
+extern void* ece391_shm_attach (uint32_t id);
+extern int32_t ece391_shm_detach (void* addr);
 
 enum signums {
 	DIV_ZERO = 0,
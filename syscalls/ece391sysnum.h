@@ -13,5 +13,18 @@
 #define SYS_SIGRETURN  10
 #define SYS_CREATE  11
 #define SYS_DELETE  12
+#define SYS_FORK    13
+#define SYS_EXEC    14
+#define SYS_WAIT    15
+#define SYS_YIELD   16
+#define SYS_SLEEP_MS    17
+#define SYS_NANOSLEEP   18
+#define SYS_BRK     19
+#define SYS_SBRK    20
+#define SYS_MMAP    21
+#define SYS_MUNMAP  22
+#define SYS_SHM_CREATE  23
+#define SYS_SHM_ATTACH  24
+#define SYS_SHM_DETACH  25
 
 #endif /* ECE391SYSNUM_H */